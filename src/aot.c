@@ -0,0 +1,670 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef BUILTIN_GETOPT
+#include "builtin_getopt.h"
+#else
+#include <unistd.h>
+#endif
+
+#include "aot.h"
+#include "help.h"
+#include "vm.h"
+#include "ram.h"
+#include "opcode.h"
+
+/* Ahead-of-time compiler: translates all code reachable from the start
+ * address to a standalone C program. Every instruction gets a label and
+ * branches become gotos, RTS jumps through a switch over all return
+ * addresses of BSR instructions. The generated program also contains an
+ * interpreter built from the same snippets. Execution continues there for
+ * good whenever the compiled code can't handle something: an RTS to an
+ * unknown address, an instruction near the end of RAM, or a store hitting
+ * compiled code.
+ *
+ * Once the program stops, the machine state isn't observable any more, so
+ * compiled code just stops on every error instead of reproducing partial
+ * effects of the failing instruction.
+ */
+
+/* semantics of every instruction. Multimode instructions find their
+ * operand address in addr and the byte there in v. FAIL stops the machine,
+ * W() stores a byte. */
+static const char *const mmSnippets[] =
+{
+    [O_LDA >> 3] = "a = v; NZ(a);",
+    [O_STA >> 3] = "W(addr, a);",
+    [O_LDX >> 3] = "x = v; NZ(x);",
+    [O_STX >> 3] = "W(addr, x);",
+    [O_LDY >> 3] = "y = v; NZ(y);",
+    [O_STY >> 3] = "W(addr, y);",
+    [O_AND >> 3] = "a &= v; NZ(a);",
+    [O_ORA >> 3] = "a |= v; NZ(a);",
+    [O_EOR >> 3] = "a ^= v; NZ(a);",
+    [O_LSR >> 3] = "carry = v & 1; v >>= 1; NZ(v); W(addr, v);",
+    [O_ASL >> 3] = "carry = v >> 7; v <<= 1; NZ(v); W(addr, v);",
+    [O_ROR >> 3] = "t = carry << 7; carry = v & 1; v = v >> 1 | t; "
+        "NZ(v); W(addr, v);",
+    [O_ROL >> 3] = "t = carry; carry = v >> 7; v = v << 1 | t; "
+        "NZ(v); W(addr, v);",
+    [O_ADC >> 3] = "adc(v);",
+    [O_SBC >> 3] = "sbc(v);",
+    [O_INC >> 3] = "++v; NZ(v); W(addr, v);",
+    [O_DEC >> 3] = "--v; NZ(v); W(addr, v);",
+    [O_CMP >> 3] = "cmp(a, v);",
+    [O_CPX >> 3] = "cmp(x, v);",
+    [O_CPY >> 3] = "cmp(y, v);",
+    [O_WUD >> 3] = "printf(\"%u\", v); fflush(stdout);",
+    [O_WSD >> 3] = "printf(\"%d\", (int8_t)v); fflush(stdout);",
+    [O_WCH >> 3] = "putchar(v); fflush(stdout);",
+    [O_WTX >> 3] = "fputs((char *)m + addr, stdout); fflush(stdout);"
+};
+
+/* RTS and the instructions with a buffer operand need special handling in
+ * both contexts */
+static const char *const impSnippets[] =
+{
+    [O_HLT - O_AM_IMPLICIT] = "FAIL;",
+    [O_SRA - O_AM_IMPLICIT] = "carry = a & 1; a >>= 1; NZ(a);",
+    [O_SLA - O_AM_IMPLICIT] = "carry = a >> 7; a <<= 1; NZ(a);",
+    [O_RRA - O_AM_IMPLICIT] = "t = carry << 7; carry = a & 1; "
+        "a = a >> 1 | t; NZ(a);",
+    [O_RLA - O_AM_IMPLICIT] = "t = carry; carry = a >> 7; "
+        "a = a << 1 | t; NZ(a);",
+    [O_INA - O_AM_IMPLICIT] = "++a; NZ(a);",
+    [O_DEA - O_AM_IMPLICIT] = "--a; NZ(a);",
+    [O_INX - O_AM_IMPLICIT] = "++x; NZ(x);",
+    [O_DEX - O_AM_IMPLICIT] = "--x; NZ(x);",
+    [O_INY - O_AM_IMPLICIT] = "++y; NZ(y);",
+    [O_DEY - O_AM_IMPLICIT] = "--y; NZ(y);",
+    [O_SEZ - O_AM_IMPLICIT] = "zres = 0;",
+    [O_CLZ - O_AM_IMPLICIT] = "zres = 1;",
+    [O_SEN - O_AM_IMPLICIT] = "nres = 0x80;",
+    [O_CLN - O_AM_IMPLICIT] = "nres = 0;",
+    [O_SEC - O_AM_IMPLICIT] = "carry = 1;",
+    [O_CLC - O_AM_IMPLICIT] = "carry = 0;",
+    [O_TAX - O_AM_IMPLICIT] = "x = a; NZ(x);",
+    [O_TXA - O_AM_IMPLICIT] = "a = x; NZ(a);",
+    [O_TAY - O_AM_IMPLICIT] = "y = a; NZ(y);",
+    [O_TYA - O_AM_IMPLICIT] = "a = y; NZ(a);",
+    [O_TXY - O_AM_IMPLICIT] = "y = x; NZ(y);",
+    [O_TYX - O_AM_IMPLICIT] = "x = y; NZ(x);",
+    [O_PHA - O_AM_IMPLICIT] = "if (sp == 256) FAIL; stack[sp++] = a;",
+    [O_PLA - O_AM_IMPLICIT] = "if (!sp) FAIL; a = stack[--sp];",
+    [O_PHX - O_AM_IMPLICIT] = "if (sp == 256) FAIL; stack[sp++] = x;",
+    [O_PLX - O_AM_IMPLICIT] = "if (!sp) FAIL; x = stack[--sp];",
+    [O_PHY - O_AM_IMPLICIT] = "if (sp == 256) FAIL; stack[sp++] = y;",
+    [O_PLY - O_AM_IMPLICIT] = "if (!sp) FAIL; y = stack[--sp];",
+    [O_WNL - O_AM_IMPLICIT] = "putchar('\\n'); fflush(stdout);",
+    [O_WTB - O_AM_IMPLICIT] = "putchar('\\t'); fflush(stdout);",
+    [O_WSP - O_AM_IMPLICIT] = "putchar(' '); fflush(stdout);",
+    [O_RUD - O_AM_IMPLICIT] = "fgets((char *)buf, 1024, stdin); u = 0U; "
+        "if (sscanf((char *)buf, \"%u\", &u) < 0) FAIL; a = u;",
+    [O_RSD - O_AM_IMPLICIT] = "fgets((char *)buf, 1024, stdin); s = 0; "
+        "if (sscanf((char *)buf, \"%d\", &s) < 0) FAIL; a = (int8_t)s;",
+    [O_RCH - O_AM_IMPLICIT] = "s = getchar(); if (s < 0) FAIL; a = s;"
+};
+
+/* branch conditions, BSR is handled separately */
+static const char *const conditions[] =
+{
+    "1", "1", "zres", "!zres", "!(nres & 0x80)", "nres & 0x80",
+    "!carry", "carry"
+};
+
+static const char *const runtime =
+    "#include <stdio.h>\n"
+    "#include <stdint.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "static uint8_t code[0x10000];\n"
+    "static uint8_t buf[1024];\n"
+    "static uint8_t a, x, y, zres = 1, nres, carry;\n"
+    "static uint16_t pc = START, sp;\n"
+    "static uint8_t stack[256];\n"
+    "static int smc;\n"
+    "\n"
+    "#define NZ(r) (zres = nres = (r))\n"
+    "#define W(at, val) do { \\\n"
+    "    uint16_t w_ = (at); \\\n"
+    "    if (w_ < SIZE) m[w_] = (val); \\\n"
+    "    smc |= code[w_]; \\\n"
+    "} while (0)\n"
+    "\n"
+    "static uint8_t get(unsigned at)\n"
+    "{\n"
+    "    return at < SIZE ? m[at] : 0;\n"
+    "}\n"
+    "\n"
+    "static void adc(uint8_t v)\n"
+    "{\n"
+    "    int c = carry;\n"
+    "    a += v;\n"
+    "    carry = a < v;\n"
+    "    if (c && !++a) carry = 1;\n"
+    "    NZ(a);\n"
+    "}\n"
+    "\n"
+    "static void sbc(uint8_t v)\n"
+    "{\n"
+    "    int c = carry;\n"
+    "    a -= v;\n"
+    "    carry = a <= v;\n"
+    "    if (!c && !a--) carry = 0;\n"
+    "    NZ(a);\n"
+    "}\n"
+    "\n"
+    "static void cmp(uint8_t r, uint8_t v)\n"
+    "{\n"
+    "    uint8_t d = r - v;\n"
+    "    carry = d < r;\n"
+    "    NZ(d);\n"
+    "}\n"
+    "\n"
+    "static int rtx(unsigned page)\n"
+    "{\n"
+    "    unsigned at = page << 8;\n"
+    "    size_t len;\n"
+    "    if (!fgets((char *)buf, 1024, stdin)) return -1;\n"
+    "    buf[strcspn((char *)buf, \"\\n\")] = 0;\n"
+    "    len = strlen((char *)buf) + 1;\n"
+    "    if (len > 256)\n"
+    "    {\n"
+    "        len = 256;\n"
+    "        buf[255] = 0;\n"
+    "    }\n"
+    "    if (len > SIZE || len + at > SIZE) return -1;\n"
+    "    memcpy(m + at, buf, len);\n"
+    "    for (size_t i = 0; i < len; ++i) smc |= code[at + i];\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static int rbk(unsigned page)\n"
+    "{\n"
+    "    unsigned at = page << 8, len = x ? x : 256, n;\n"
+    "    if (at + len > SIZE) return -1;\n"
+    "    n = fread(m + at, 1, len, stdin);\n"
+    "    for (unsigned i = 0; i < n; ++i) smc |= code[at + i];\n"
+    "    x = n;\n"
+    "    carry = !n;\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "static int wbk(unsigned page)\n"
+    "{\n"
+    "    unsigned at = page << 8, len = x ? x : 256;\n"
+    "    if (at + len > SIZE) return -1;\n"
+    "    fwrite(m + at, 1, len, stdout);\n"
+    "    fflush(stdout);\n"
+    "    return 0;\n"
+    "}\n"
+    "\n"
+    "#define FAIL return -1\n"
+    "\n"
+    "static int step(void)\n"
+    "{\n"
+    "    uint8_t op = get(pc), v, t;\n"
+    "    uint16_t addr = 0;\n"
+    "    unsigned u;\n"
+    "    int s, rc = 0;\n"
+    "\n"
+    "    if (++pc >= SIZE) rc = -1;\n"
+    "    if (op >= 0xf0)\n"
+    "    {\n"
+    "        int dojump = 1;\n"
+    "        if (rc) return rc;\n"
+    "        t = get(pc++);\n"
+    "        if (op & 1)\n"
+    "        {\n"
+    "            if (pc >= SIZE) return -1;\n"
+    "            addr = get(pc++) << 8 | t;\n"
+    "        }\n"
+    "        else\n"
+    "        {\n"
+    "            if (pc + (int8_t)t < 0) return -1;\n"
+    "            addr = pc + (int8_t)t;\n"
+    "        }\n"
+    "        switch (op >> 1 & 7)\n"
+    "        {\n"
+    "            case 0:\n"
+    "                if (sp == 256) return -1;\n"
+    "                stack[sp++] = pc & 0xff;\n"
+    "                if (sp == 256) return -1;\n"
+    "                stack[sp++] = pc >> 8;\n"
+    "                break;\n";
+
+static const char *const runtimeImplicit =
+    "        }\n"
+    "        if (dojump)\n"
+    "        {\n"
+    "            if (addr >= SIZE) return -1;\n"
+    "            pc = addr;\n"
+    "        }\n"
+    "        return 0;\n"
+    "    }\n"
+    "    if (op >= 0xc0)\n"
+    "    {\n"
+    "        switch (op)\n"
+    "        {\n"
+    "            case 0xc1:\n"
+    "                if (sp == 0) return -1;\n"
+    "                pc = stack[--sp] << 8;\n"
+    "                if (sp == 0) return -1;\n"
+    "                pc |= stack[--sp];\n"
+    "                if (pc >= SIZE) return -1;\n"
+    "                break;\n"
+    "            case 0xe4:\n"
+    "                u = get(pc++);\n"
+    "                if (pc >= SIZE) return -1;\n"
+    "                if (rtx(u) < 0) return -1;\n"
+    "                break;\n"
+    "            case 0xe5:\n"
+    "                u = get(pc++);\n"
+    "                if (pc >= SIZE) return -1;\n"
+    "                if (rbk(u) < 0) return -1;\n"
+    "                break;\n"
+    "            case 0xe6:\n"
+    "                u = get(pc++);\n"
+    "                if (pc >= SIZE) return -1;\n"
+    "                if (wbk(u) < 0) return -1;\n"
+    "                break;\n";
+
+static const char *const runtimeMultimode =
+    "            default:\n"
+    "                return -1;\n"
+    "        }\n"
+    "        return rc;\n"
+    "    }\n"
+    "    if (rc) return rc;\n"
+    "    switch (op & 7)\n"
+    "    {\n"
+    "        case 0:\n"
+    "            addr = pc++;\n"
+    "            if (pc >= SIZE) rc = -1;\n"
+    "            break;\n"
+    "        case 1:\n"
+    "        case 3:\n"
+    "        case 5:\n"
+    "            t = get(pc++);\n"
+    "            if (pc >= SIZE) return -1;\n"
+    "            addr = (get(pc++) << 8 | t)\n"
+    "                + (op & 2 ? x : op & 4 ? y : 0);\n"
+    "            if (pc >= SIZE) rc = -1;\n"
+    "            break;\n"
+    "        case 2:\n"
+    "        case 4:\n"
+    "        case 6:\n"
+    "            addr = get(pc++) + (op & 4 ? (op & 2 ? y : x) : 0);\n"
+    "            if (pc >= SIZE) rc = -1;\n"
+    "            break;\n"
+    "        case 7:\n"
+    "            t = get(pc++);\n"
+    "            if (pc >= SIZE) rc = -1;\n"
+    "            if (t + 1 > SIZE) return -1;\n"
+    "            addr = (get(t) | get(t + 1) << 8) + y;\n"
+    "            break;\n"
+    "    }\n"
+    "    if (addr > SIZE) return -1;\n"
+    "    v = get(addr);\n"
+    "    switch (op & 0xf8)\n"
+    "    {\n";
+
+static const char *const runtimeCompiled =
+    "    }\n"
+    "    return rc;\n"
+    "}\n"
+    "\n"
+    "#undef FAIL\n"
+    "#define FAIL goto halt\n"
+    "\n"
+    "static void run(void)\n"
+    "{\n"
+    "    uint8_t v, t;\n"
+    "    uint16_t addr;\n"
+    "    unsigned u;\n"
+    "    int s;\n"
+    "\n"
+    "    (void)v; (void)t; (void)addr; (void)u; (void)s;\n";
+
+static const char *const runtimeEnd =
+    "fallback:\n"
+    "    while (step() >= 0);\n"
+    "halt:\n"
+    "    return;\n"
+    "}\n"
+    "\n"
+    "int main(void)\n"
+    "{\n"
+    "    setvbuf(stdin, 0, _IONBF, 0);\n"
+    "    for (int i = 0; ranges[i][1]; ++i)\n"
+    "    {\n"
+    "        memset(code + ranges[i][0], 1, ranges[i][1]);\n"
+    "    }\n"
+    "    run();\n"
+    "    return 0;\n"
+    "}\n";
+
+typedef struct Aot
+{
+    const uint8_t *m;
+    size_t size;
+    FILE *out;
+    uint8_t reached[RAM_MAXSIZE];
+    uint8_t retaddr[RAM_MAXSIZE];
+    uint8_t compiled[RAM_MAXSIZE];
+    uint16_t todo[RAM_MAXSIZE];
+    size_t ntodo;
+} Aot;
+
+static void reach(Aot *self, uint32_t pc)
+{
+    if (pc >= self->size || self->reached[pc]) return;
+    self->reached[pc] = 1;
+    self->todo[self->ntodo++] = pc;
+}
+
+/* returns the length of the instruction if it can be compiled, 0 if it
+ * must run in the interpreter */
+static unsigned compilable(const Aot *self, uint16_t pc, int *target)
+{
+    const OpcodeInfo *oi = Opcode_info(self->m[pc]);
+    unsigned len = oi->size;
+
+    *target = -1;
+    if (oi->cls == OC_ILLEGAL) return 0;
+    if (pc + len >= self->size) return 0;
+    if (oi->cls == OC_MULTIMODE)
+    {
+        uint8_t arg1 = self->m[pc + 1];
+        if (oi->mode == O_AM_ABSOLUTE
+                && (size_t)(arg1 | self->m[pc + 2] << 8) > self->size) return 0;
+        if (oi->mode == O_AM_ZP_ABS && arg1 > self->size) return 0;
+        if (oi->mode == O_AM_ZP_IND_Y && arg1 + 1U > self->size) return 0;
+    }
+    else if (oi->cls == OC_BRANCH)
+    {
+        if (oi->mode == O_AM_ABSOLUTE)
+        {
+            *target = self->m[pc + 1] | self->m[pc + 2] << 8;
+        }
+        else
+        {
+            *target = pc + 2 + (int8_t)self->m[pc + 1];
+        }
+        if (*target < 0 || (size_t)*target >= self->size) return 0;
+    }
+    return len;
+}
+
+static void walk(Aot *self, uint16_t start)
+{
+    reach(self, start);
+    while (self->ntodo)
+    {
+        uint16_t pc = self->todo[--self->ntodo];
+        uint8_t op = self->m[pc];
+        int target;
+        unsigned len = compilable(self, pc, &target);
+        if (!len) continue;
+        memset(self->compiled + pc, 1, len);
+        if (op == O_HLT) continue;
+        if (op == O_RTS) continue;
+        if (target >= 0)
+        {
+            reach(self, target);
+            if ((op & 0xfe) == O_BRA) continue;
+            if ((op & 0xfe) == O_BSR) self->retaddr[pc + len] = 1;
+        }
+        reach(self, pc + len);
+    }
+}
+
+static const char *mmAddress(uint8_t mode)
+{
+    switch (mode)
+    {
+        case O_AM_IDX_X: return "    addr = 0x%04x + x;\n";
+        case O_AM_ZP_IDX_X: return "    addr = 0x%02x + x;\n";
+        case O_AM_IDX_Y: return "    addr = 0x%04x + y;\n";
+        case O_AM_ZP_IDX_Y: return "    addr = 0x%02x + y;\n";
+        case O_AM_ZP_IND_Y:
+            return "    addr = (get(0x%02x) | get(0x%02x + 1) << 8) + y;\n";
+        default: return "    addr = 0x%04x;\n";
+    }
+}
+
+/* returns 1 if execution can continue with the next instruction */
+static int emitInsn(Aot *self, uint16_t pc)
+{
+    FILE *out = self->out;
+    uint8_t op = self->m[pc];
+    const OpcodeInfo *oi = Opcode_info(op);
+    int target;
+    unsigned len = compilable(self, pc, &target);
+
+    fprintf(out, "L_%04x:\n", pc);
+    if (!len)
+    {
+        fprintf(out, "    pc = 0x%04x;\n    goto fallback;\n", pc);
+        return 0;
+    }
+
+    if (oi->cls == OC_MULTIMODE)
+    {
+        uint8_t arg1 = self->m[pc + 1];
+        unsigned arg = oi->size == 3 ? arg1 | self->m[pc + 2] << 8 : arg1;
+        if (oi->mode == O_AM_IMMEDIATE) arg = pc + 1;
+        fprintf(out, mmAddress(oi->mode), arg, arg);
+        if (oi->mode > O_AM_ZP_ABS && self->size < RAM_MAXSIZE)
+        {
+            fprintf(out, "    if (addr > SIZE) goto halt;\n");
+        }
+        fprintf(out, "    v = get(addr);\n    ");
+        fputs(mmSnippets[op >> 3], out);
+        fputs("\n", out);
+        if (strstr(mmSnippets[op >> 3], "W("))
+        {
+            fprintf(out, "    if (smc)\n    {\n        pc = 0x%04x;\n"
+                    "        goto fallback;\n    }\n", pc + len);
+        }
+        return 1;
+    }
+
+    if (oi->cls == OC_BRANCH)
+    {
+        if ((op & 0xfe) == O_BSR)
+        {
+            fprintf(out, "    if (sp >= 255) goto halt;\n"
+                    "    stack[sp++] = 0x%02x;\n    stack[sp++] = 0x%02x;\n",
+                    (pc + len) & 0xff, (pc + len) >> 8);
+            fprintf(out, "    goto L_%04x;\n", target);
+            return 0;
+        }
+        fprintf(out, "    if (%s) goto L_%04x;\n",
+                conditions[(op >> 1) & 7], target);
+        return (op & 0xfe) != O_BRA;
+    }
+
+    if (op == O_RTS)
+    {
+        fputs("    if (sp < 2) goto halt;\n"
+                "    pc = stack[sp - 1] << 8 | stack[sp - 2];\n"
+                "    sp -= 2;\n"
+                "    if (pc >= SIZE) goto halt;\n"
+                "    goto ret;\n", out);
+        return 0;
+    }
+    if (op == O_RTX || op == O_RBK)
+    {
+        fprintf(out, "    if (%s(0x%02x) < 0) goto halt;\n"
+                "    if (smc)\n    {\n        pc = 0x%04x;\n"
+                "        goto fallback;\n    }\n",
+                op == O_RTX ? "rtx" : "rbk", self->m[pc + 1], pc + len);
+        return 1;
+    }
+    if (op == O_WBK)
+    {
+        fprintf(out, "    if (wbk(0x%02x) < 0) goto halt;\n", self->m[pc + 1]);
+        return 1;
+    }
+    fputs("    ", out);
+    fputs(impSnippets[op - O_AM_IMPLICIT], out);
+    fputs("\n", out);
+    return op != O_HLT;
+}
+
+static void emitRanges(Aot *self)
+{
+    FILE *out = self->out;
+    fputs("\nstatic const unsigned ranges[][2] = {\n", out);
+    for (size_t pc = 0; pc < self->size;)
+    {
+        if (!self->compiled[pc])
+        {
+            ++pc;
+            continue;
+        }
+        size_t end = pc;
+        while (end < self->size && self->compiled[end]) ++end;
+        fprintf(out, "    { 0x%04zx, 0x%04zx },\n", pc, end - pc);
+        pc = end;
+    }
+    fputs("    { 0, 0 }\n};\n", out);
+}
+
+static void emit(Aot *self, uint16_t start)
+{
+    FILE *out = self->out;
+    size_t last = self->size;
+
+    while (last && !self->m[last - 1]) --last;
+    fputs("/* generated by gvm aot */\n\n", out);
+    fprintf(out, "#define SIZE 0x%zx\n#define START 0x%04x\n\n",
+            self->size, start);
+    fputs("static unsigned char m[SIZE + 1] = {", out);
+    for (size_t i = 0; i < last; ++i)
+    {
+        fprintf(out, "%s0x%02x,", i % 12 ? " " : "\n    ", self->m[i]);
+    }
+    fputs("\n};\n", out);
+    emitRanges(self);
+    fputs("\n", out);
+
+    fputs(runtime, out);
+    for (int i = 1; i < 8; ++i)
+    {
+        fprintf(out, "            case %d:\n"
+                "                dojump = %s;\n"
+                "                break;\n", i, conditions[i]);
+    }
+    fputs(runtimeImplicit, out);
+    for (int i = 0; i < (int)(sizeof impSnippets / sizeof *impSnippets); ++i)
+    {
+        if (!impSnippets[i]) continue;
+        fprintf(out, "            case 0x%02x:\n                ",
+                i + O_AM_IMPLICIT);
+        fputs(impSnippets[i], out);
+        fputs("\n                break;\n", out);
+    }
+    fputs(runtimeMultimode, out);
+    for (int i = 0; i < (int)(sizeof mmSnippets / sizeof *mmSnippets); ++i)
+    {
+        fprintf(out, "        case 0x%02x:\n            ", i << 3);
+        fputs(mmSnippets[i], out);
+        fputs("\n            break;\n", out);
+    }
+    fputs(runtimeCompiled, out);
+
+    fprintf(out, "    goto L_%04x;\n", start);
+    int cont = 0;
+    for (size_t pc = 0; pc < self->size; ++pc)
+    {
+        if (!self->reached[pc]) continue;
+        if (cont && cont != (int)pc) fprintf(out, "    goto L_%04x;\n", cont);
+        cont = emitInsn(self, pc) ? pc + Opcode_info(self->m[pc])->size : 0;
+    }
+    if (cont) fprintf(out, "    goto L_%04x;\n", cont);
+
+    fputs("ret:\n    switch (pc)\n    {\n", out);
+    for (size_t pc = 0; pc < self->size; ++pc)
+    {
+        if (self->retaddr[pc])
+        {
+            fprintf(out, "        case 0x%04zx: goto L_%04zx;\n", pc, pc);
+        }
+    }
+    fputs("    }\n", out);
+    fputs(runtimeEnd, out);
+}
+
+int aotmain(int argc, char **argv)
+{
+    uint16_t start = 0x100;
+    int userstart = 0;
+    int xram = 0;
+    int hex = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "rs:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                xram = 1;
+                if (!userstart) start = 0;
+                break;
+            case 's':
+                userstart = 1;
+                start = atoi(optarg);
+                break;
+            case 'h':
+                hex = 1;
+                break;
+            default:
+                showusage(argv[-1]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc-1)
+    {
+        showusage(argv[-1]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *prg = fopen(argv[optind], hex?"r":"rb");
+    if (!prg)
+    {
+        fprintf(stderr, "Error opening %s for reading.\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    Ram *ram = xram ? createXram(prg, hex, 0) : createXcode(prg, hex, start);
+    fclose(prg);
+    if (!ram) return EXIT_FAILURE;
+    if (start >= Ram_size(ram))
+    {
+        fputs("Start address out of range.\n", stderr);
+        Ram_destroy(ram);
+        return EXIT_FAILURE;
+    }
+
+    Aot *self = calloc(1, sizeof *self);
+    if (!self || !(self->m = Ram_data(ram)))
+    {
+        free(self);
+        Ram_destroy(ram);
+        return EXIT_FAILURE;
+    }
+    self->size = Ram_size(ram);
+    self->out = stdout;
+
+    walk(self, start);
+    emit(self, start);
+
+    free(self);
+    Ram_destroy(ram);
+    return EXIT_SUCCESS;
+}
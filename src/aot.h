@@ -0,0 +1,6 @@
+#ifndef AOT_H
+#define AOT_H
+
+int aotmain(int argc, char **argv);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include "converter.h"
+#include "hexreader.h"
 #include "ram.h"
 
 struct Converter
@@ -36,26 +37,22 @@ Converter *Converter_create(const Ram *ram)
     return self;
 }
 
-int Converter_readTable(Converter *self, FILE *convtable)
+int Converter_readTable(Converter *self, HexReader *reader)
 {
+    uint8_t pairs[512];
+    long n;
+
     idmap(self);
-    unsigned from, to;
-    int rc;
-    while ((rc = fscanf(convtable, "%x", &from)) > 0)
+    while ((n = HexReader_read(reader, pairs, sizeof pairs)) > 0)
     {
-        if ((rc = fscanf(convtable, "%x", &to)) < 1)
-        {
-            idmap(self);
-            return -1;
-        }
-        if (from > 0xff || to > 0xff)
+        if (n % 2)
         {
             idmap(self);
             return -1;
         }
-        self->map[from] = to;
+        for (long i = 0; i < n; i += 2) self->map[pairs[i]] = pairs[i + 1];
     }
-    if (!rc)
+    if (n < 0)
     {
         idmap(self);
         return -1;
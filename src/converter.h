@@ -1,14 +1,15 @@
 #ifndef CONVERTER_H
 #define CONVERTER_H
 
-#include <stdio.h>
 #include <stdint.h>
 
 typedef struct Ram Ram;
 typedef struct Converter Converter;
+typedef struct HexReader HexReader;
 
 Converter *Converter_create(const Ram *ram);
-int Converter_readTable(Converter *self, FILE *convtable);
+/* reads pairs of from and to opcodes until the end of the input */
+int Converter_readTable(Converter *self, HexReader *reader);
 int Converter_writeOpcode(const Converter *self, uint8_t opcode, uint16_t at);
 int Converter_writeData(const Converter *self, uint8_t data, uint16_t at);
 const Ram *Converter_input(const Converter *self);
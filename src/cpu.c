@@ -3,687 +3,188 @@
 #include <string.h>
 #include <stdio.h>
 
-#include "cpu.h"
-#include "ram.h"
+#include "cpuimpl.h"
+#include "ramimpl.h"
 #include "converter.h"
 #include "opcode.h"
+#include "verifier.h"
+#include "input.h"
+#include "output.h"
+#include "tracer.h"
 
-struct Cpu
+/* decimal representations of all byte values, the length in the last byte */
+static char decimal[256][4];
+
+static void initDecimal(void)
 {
-    Ram *ram;
-    Converter *conv;
-    CpuFlags flags;
-    uint16_t pc;
-    uint16_t sp;
-    uint8_t stack[256];
-    uint8_t regs[3];
-};
+    char buf[4];
+    for (unsigned i = 0; i < 256; ++i)
+    {
+        int len = sprintf(buf, "%u", i);
+        memcpy(decimal[i], buf, len);
+        decimal[i][3] = len;
+    }
+}
+
+static void writeDecimal(Cpu *self, uint8_t v)
+{
+    Output_write(self->output, decimal[v], decimal[v][3]);
+}
 
 Cpu *Cpu_create(Ram *ram, uint16_t pc, Converter *conv)
 {
     if (pc >= Ram_size(ram)) return 0;
     Cpu *self = calloc(1, sizeof *self);
     if (!self) return 0;
+    if (!decimal[0][3]) initDecimal();
+    self->input = Input_create(0, 1);
+    self->output = Output_createFile(stdout);
+    if (!self->input || !self->output)
+    {
+        Cpu_destroy(self);
+        return 0;
+    }
+    Input_tie(self->input, self->output);
     self->ram = ram;
     self->conv = conv;
     self->pc = pc;
+    self->interactive = 1;
+    CLZ(self->flags);
     return self;
 }
 
-#define SR(x) do { \
-    if ((x) & 1) self->flags |= CF_CARRY; \
-    else self->flags &= ~CF_CARRY; \
-    (x) >>= 1; \
-} while(0)
-
-#define SL(x) do { \
-    if ((x) & 0x80) self->flags |= CF_CARRY; \
-    else self->flags &= ~CF_CARRY; \
-    (x) <<= 1; \
-} while(0)
-
-#define RR(x) do { \
-    uint8_t c = 0x80 * !!(self->flags & CF_CARRY); \
-    if ((x) & 1) self->flags |= CF_CARRY; \
-    else self->flags &= ~CF_CARRY; \
-    (x) = (x) >> 1 | c; \
-} while(0)
-
-#define RL(x) do { \
-    uint8_t c = !!(self->flags & CF_CARRY); \
-    if ((x) & 0x80) self->flags |= CF_CARRY; \
-    else self->flags &= ~CF_CARRY; \
-    (x) = (x) << 1 | c; \
-} while(0)
-
-#define NZ(x) do { \
-    if ((x)) self->flags &= ~CF_ZERO; \
-    else self->flags |= CF_ZERO; \
-    if ((x) & 0x80) self->flags |= CF_NEGATIVE; \
-    else self->flags &= ~CF_NEGATIVE; \
-} while(0)
+static void traceStart(const Cpu *self, TraceRecord *rec)
+{
+    rec->pc = self->pc;
+    memcpy(rec->regs, self->regs, 3);
+    rec->flags = FLAGS(self->flags);
+    rec->nbytes = 0;
+    rec->operand = 0;
+    rec->hasres = 0;
+}
 
-static void logByte(char *dis, int off, uint8_t byte)
+static void traceByte(TraceRecord *rec, uint8_t byte)
 {
-    char buf[3];
-    if (dis)
-    {
-        sprintf(buf, "%02x", byte);
-        memcpy(dis+off, buf, 2);
-    }
+    rec->bytes[rec->nbytes++] = byte;
 }
 
-static void logInst(char *dis, const char *inst)
+static void traceOperand(TraceRecord *rec)
 {
-    if (dis)
-    {
-        memcpy(dis+12, inst, strlen(inst));
-    }
+    rec->operand = 1;
 }
 
-static void logAbs(char *dis, uint16_t addr, char *index)
+static void traceResult(TraceRecord *rec, uint8_t res)
 {
-    char buf[8];
-    if (dis)
-    {
-        sprintf(buf, "$%04x", addr);
-        if (index) strcat(buf, index);
-        memcpy(dis+16, buf, strlen(buf));
-    }
+    rec->hasres = 1;
+    rec->res = res;
 }
 
-static void logRel(char *dis, int8_t off)
+static void outputDone(Cpu *self)
 {
-    char buf[5];
-    if (dis)
-    {
-        sprintf(buf, "%+d", off);
-        memcpy(dis+16, buf, strlen(buf));
-    }
+    if (self->interactive) Output_flush(self->output);
+    else Output_checkInterval(self->output);
 }
 
-static void logImm(char *dis, int8_t arg)
+#define EXEC_STEP stepPlain
+#define EXEC_RUN runPlain
+#include "cpuexec.h"
+
+#define EXEC_STEP stepConv
+#define EXEC_RUN runConv
+#define EXEC_CONV
+#include "cpuexec.h"
+
+#define EXEC_STEP stepTrace
+#define EXEC_RUN runTrace
+#define EXEC_TRACE
+#include "cpuexec.h"
+
+#define EXEC_STEP stepUnchecked
+#define EXEC_RUN runUnchecked
+#define EXEC_UNCHECKED
+#include "cpuexec.h"
+
+#define EXEC_STEP stepFlat
+#define EXEC_RUN runFlat
+#define EXEC_FLAT
+#include "cpuexec.h"
+
+static int runVerified(Cpu *self, uint64_t maxSteps)
 {
-    char buf[5];
-    if (dis)
+    const uint8_t *safe = Verifier_safe(self->verifier);
+    do
     {
-        sprintf(buf, "#$%02x", arg);
-        memcpy(dis+16, buf, 4);
-    }
+        if (safe[self->pc])
+        {
+            if (stepUnchecked(self, 0) < 0) return -1;
+        }
+        else if (stepPlain(self, 0) < 0) return -1;
+    } while (--maxSteps);
+    return 0;
 }
 
-static void logZp(char *dis, uint8_t addr, char *index)
+int Cpu_step(Cpu *self, char *dis)
 {
-    char buf[6];
     if (dis)
     {
-        sprintf(buf, "$%02x", addr);
-        if (index) strcat(buf, index);
-        memcpy(dis+16, buf, strlen(buf));
+        TraceRecord rec;
+        int rc = stepTrace(self, &rec);
+        Tracer_disassemble(&rec, dis);
+        return rc;
     }
+    if (self->conv) return stepConv(self, 0);
+    return stepPlain(self, 0);
 }
 
-static void logZpInd(char *dis, uint8_t addr)
+int Cpu_run(Cpu *self, uint64_t maxSteps)
 {
-    char buf[8];
-    if (dis)
+    if (self->tracer) return runTrace(self, maxSteps);
+    if (self->conv) return runConv(self, maxSteps);
+    if (Ram_size(self->ram) == RAM_MAXSIZE)
     {
-        sprintf(buf, "($%02x),Y", addr);
-        memcpy(dis+16, buf, 7);
+        /* materializing the image once makes every read a single load,
+         * banks need the pages to switch */
+        if (Ram_data(self->ram)) return runFlat(self, maxSteps);
+        return runUnchecked(self, maxSteps);
     }
+    /* other engines only use Cpu_step(), so the verifier is free to watch
+     * writes to the Ram */
+    if (!self->verifier) self->verifier = Verifier_create(self->ram, self->pc);
+    if (self->verifier) return runVerified(self, maxSteps);
+    return runPlain(self, maxSteps);
 }
 
-static void logRes(char *dis, uint8_t res)
+void Cpu_setTrace(Cpu *self, Tracer *tracer)
 {
-    char buf[6];
-    if (dis)
-    {
-        sprintf(buf, "; $%02x", res);
-        memcpy(dis+26, buf, 5);
-    }
+    self->tracer = tracer;
 }
 
-int Cpu_step(Cpu *self, char *dis)
+void Cpu_setOutput(Cpu *self, int interactive, unsigned interval)
 {
-    if (dis) strcpy(dis, "                               ");
-    int rc = 0;
-    uint8_t op = Ram_get(self->ram, self->pc);
-    if (self->conv) Converter_writeOpcode(self->conv, op, self->pc);
-    if (++self->pc >= Ram_size(self->ram)) rc = -1;
-    logByte(dis, 0, op);
+    self->interactive = interactive;
+    self->interval = interval;
+    Output_setInterval(self->output, interval);
+}
 
-    if ((op & O_AM_IMPLICIT) == O_AM_IMPLICIT)
+void Cpu_setIo(Cpu *self, Input *input, Output *output)
+{
+    if (input)
     {
-        if ((op & O_AM_JUMP) == O_AM_JUMP)
-        {
-            if (rc) return rc;
-            uint16_t target;
-            uint8_t arg1 = Ram_get(self->ram, self->pc++);
-            logByte(dis, 3, arg1);
-            if (op & O_AM_ABSOLUTE)
-            {
-                if (self->pc >= Ram_size(self->ram)) return -1;
-                uint8_t arg2 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 6, arg2);
-                target = arg2 << 8 | arg1;
-                logAbs(dis, target, 0);
-            }
-            else
-            {
-                int8_t diff = (int8_t) arg1;
-                logRel(dis, diff);
-                if (self->pc + diff < 0) return -1;
-                target = self->pc + diff;
-            }
-            int dojump = 1;
-            switch (op & 0xfe)
-            {
-                case O_BSR:
-                    logInst(dis, "BSR");
-                    if (self->sp == 256) return -1;
-                    self->stack[self->sp++] = self->pc & 0xff;
-                    if (self->sp == 256) return -1;
-                    self->stack[self->sp++] = self->pc >> 8;
-                    break;
-                case O_BRA:
-                    logInst(dis, "BRA");
-                    break;
-                case O_BNE:
-                    if (self->flags & CF_ZERO) dojump = 0;
-                    logInst(dis, "BNE");
-                    break;
-                case O_BEQ:
-                    if (!(self->flags & CF_ZERO)) dojump = 0;
-                    logInst(dis, "BEQ");
-                    break;
-                case O_BPL:
-                    if (self->flags & CF_NEGATIVE) dojump = 0;
-                    logInst(dis, "BPL");
-                    break;
-                case O_BMI:
-                    if (!(self->flags & CF_NEGATIVE)) dojump = 0;
-                    logInst(dis, "BMI");
-                    break;
-                case O_BCC:
-                    if (self->flags & CF_CARRY) dojump = 0;
-                    logInst(dis, "BCC");
-                    break;
-                case O_BCS:
-                    if (!(self->flags & CF_CARRY)) dojump = 0;
-                    logInst(dis, "BCS");
-                    break;
-                default:
-                    logInst(dis, "ILL");
-                    return -1;
-            }
-            if (dojump)
-            {
-                rc = 0;
-                if (target >= Ram_size(self->ram)) return -1;
-                self->pc = target;
-            }
-        }
-        else
-        {
-            uint8_t buf[1024];
-            size_t len;
-            unsigned u;
-            int s;
-            switch (op)
-            {
-                case O_RTS:
-                    logInst(dis, "RTS");
-                    if (self->sp == 0) return -1;
-                    self->pc = self->stack[--self->sp] << 8;
-                    if (self->sp == 0) return -1;
-                    self->pc |= self->stack[--self->sp];
-                    if (self->pc >= Ram_size(self->ram)) return -1;
-                    break;
-                case O_SRA:
-                    logInst(dis, "SRA");
-                    SR(self->regs[CR_A]);
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_SLA:
-                    logInst(dis, "SLA");
-                    SL(self->regs[CR_A]);
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_RRA:
-                    logInst(dis, "RRA");
-                    RR(self->regs[CR_A]);
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_RLA:
-                    logInst(dis, "RLA");
-                    RL(self->regs[CR_A]);
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_INA:
-                    logInst(dis, "INA");
-                    ++self->regs[CR_A];
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_DEA:
-                    logInst(dis, "DEA");
-                    --self->regs[CR_A];
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_INX:
-                    logInst(dis, "INX");
-                    ++self->regs[CR_X];
-                    NZ(self->regs[CR_X]);
-                    break;
-                case O_DEX:
-                    logInst(dis, "DEX");
-                    --self->regs[CR_X];
-                    NZ(self->regs[CR_X]);
-                    break;
-                case O_INY:
-                    logInst(dis, "INY");
-                    ++self->regs[CR_Y];
-                    NZ(self->regs[CR_Y]);
-                    break;
-                case O_DEY:
-                    logInst(dis, "DEY");
-                    --self->regs[CR_Y];
-                    NZ(self->regs[CR_Y]);
-                    break;
-                case O_SEZ:
-                    logInst(dis, "SEZ");
-                    self->flags |= CF_ZERO;
-                    break;
-                case O_CLZ:
-                    logInst(dis, "CLZ");
-                    self->flags &= ~CF_ZERO;
-                    break;
-                case O_SEN:
-                    logInst(dis, "SEN");
-                    self->flags |= CF_NEGATIVE;
-                    break;
-                case O_CLN:
-                    logInst(dis, "CLN");
-                    self->flags &= ~CF_NEGATIVE;
-                    break;
-                case O_SEC:
-                    logInst(dis, "SEC");
-                    self->flags |= CF_CARRY;
-                    break;
-                case O_CLC:
-                    logInst(dis, "CLC");
-                    self->flags &= ~CF_CARRY;
-                    break;
-                case O_TAX:
-                    logInst(dis, "TAX");
-                    self->regs[CR_X] = self->regs[CR_A];
-                    NZ(self->regs[CR_X]);
-                    break;
-                case O_TXA:
-                    logInst(dis, "TXA");
-                    self->regs[CR_A] = self->regs[CR_X];
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_TAY:
-                    logInst(dis, "TAY");
-                    self->regs[CR_Y] = self->regs[CR_A];
-                    NZ(self->regs[CR_Y]);
-                    break;
-                case O_TYA:
-                    logInst(dis, "TYA");
-                    self->regs[CR_A] = self->regs[CR_Y];
-                    NZ(self->regs[CR_A]);
-                    break;
-                case O_TXY:
-                    logInst(dis, "TXY");
-                    self->regs[CR_Y] = self->regs[CR_X];
-                    NZ(self->regs[CR_Y]);
-                    break;
-                case O_TYX:
-                    logInst(dis, "TYX");
-                    self->regs[CR_X] = self->regs[CR_Y];
-                    NZ(self->regs[CR_X]);
-                    break;
-                case O_PHA:
-                    logInst(dis, "PHA");
-                    if (self->sp == 256) return -1;
-                    self->stack[self->sp++] = self->regs[CR_A];
-                    break;
-                case O_PLA:
-                    logInst(dis, "PLA");
-                    if (self->sp == 0) return -1;
-                    self->regs[CR_A] = self->stack[--self->sp];
-                    break;
-                case O_PHX:
-                    logInst(dis, "PHX");
-                    if (self->sp == 256) return -1;
-                    self->stack[self->sp++] = self->regs[CR_X];
-                    break;
-                case O_PLX:
-                    logInst(dis, "PLX");
-                    if (self->sp == 0) return -1;
-                    self->regs[CR_X] = self->stack[--self->sp];
-                    break;
-                case O_PHY:
-                    logInst(dis, "PHY");
-                    if (self->sp == 256) return -1;
-                    self->stack[self->sp++] = self->regs[CR_Y];
-                    break;
-                case O_PLY:
-                    logInst(dis, "PLY");
-                    if (self->sp == 0) return -1;
-                    self->regs[CR_Y] = self->stack[--self->sp];
-                    break;
-                case O_WNL:
-                    logInst(dis, "WNL");
-                    putchar('\n');
-                    fflush(stdout);
-                    break;
-                case O_WTB:
-                    logInst(dis, "WNL");
-                    putchar('\t');
-                    fflush(stdout);
-                    break;
-                case O_WSP:
-                    logInst(dis, "WNL");
-                    putchar(' ');
-                    fflush(stdout);
-                    break;
-                case O_RUD:
-                    logInst(dis, "RUD");
-                    fgets((char *)buf, 1024, stdin);
-                    u = 0U;
-                    if (sscanf((char *)buf, "%u", &u) < 0) return -1;
-                    self->regs[CR_A] = u;
-                    logRes(dis, self->regs[CR_A]);
-                    break;
-                case O_RSD:
-                    logInst(dis, "RSD");
-                    fgets((char *)buf, 1024, stdin);
-                    s = 0;
-                    if (sscanf((char *)buf, "%d", &s) < 0) return -1;
-                    self->regs[CR_A] = (int8_t)s;
-                    logRes(dis, self->regs[CR_A]);
-                    break;
-                case O_RCH:
-                    logInst(dis, "RCH");
-                    s = getchar();
-                    if (s < 0) return -1;
-                    self->regs[CR_A] = s;
-                    logRes(dis, self->regs[CR_A]);
-                    break;
-                case O_RTX:
-                    u = Ram_get(self->ram, self->pc++);
-                    logByte(dis, 3, u);
-                    if (self->pc >= Ram_size(self->ram)) return -1;
-                    logAbs(dis, u<<8, 0);
-                    logInst(dis, "RTX");
-                    fgets((char *)buf, 1024, stdin);
-                    buf[strcspn((char *)buf, "\n")] = 0;
-                    len = strlen((char *)buf)+1;
-                    if (len > 256)
-                    {
-                        len = 256;
-                        buf[255] = 0;
-                    }
-                    if (Ram_load(self->ram, u<<8, buf, len) < 0) return -1;
-                    break;
-                case O_HLT:
-                    logInst(dis, "HLT");
-                    return -1;
-                default:
-                    logInst(dis, "ILL");
-                    return -1;
-            }
-        }
+        Input_destroy(self->input);
+        self->input = input;
     }
-    else
+    if (output)
     {
-        uint8_t arg1, arg2, v;
-        uint16_t addr, ind;
-        int carry;
-        if (rc) return rc;
-        switch (op & 7)
-        {
-            case O_AM_IMMEDIATE:
-                arg1 = Ram_get(self->ram, self->pc);
-                logByte(dis, 3, arg1);
-                logImm(dis, arg1);
-                addr = self->pc++;
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                break;
-            case O_AM_ABSOLUTE:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                if (self->pc >= Ram_size(self->ram)) return -1;
-                arg2 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 6, arg2);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                addr = arg2 << 8 | arg1;
-                logAbs(dis, addr, 0);
-                break;
-            case O_AM_ZP_ABS:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                addr = arg1;
-                logZp(dis, arg1, 0);
-                break;
-            case O_AM_IDX_X:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                if (self->pc >= Ram_size(self->ram)) return -1;
-                arg2 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 6, arg2);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                addr = (arg2 << 8 | arg1) + self->regs[CR_X];
-                logAbs(dis, (arg2 << 8 | arg1), ",X");
-                break;
-            case O_AM_ZP_IDX_X:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                addr = arg1 + self->regs[CR_X];
-                logZp(dis, arg1, ",X");
-                break;
-            case O_AM_IDX_Y:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                if (self->pc >= Ram_size(self->ram)) return -1;
-                arg2 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 6, arg2);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                addr = (arg2 << 8 | arg1) + self->regs[CR_Y];
-                logAbs(dis, (arg2 << 8 | arg1), ",Y");
-                break;
-            case O_AM_ZP_IDX_Y:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                addr = arg1 + self->regs[CR_Y];
-                logZp(dis, arg1, ",Y");
-                break;
-            case O_AM_ZP_IND_Y:
-                arg1 = Ram_get(self->ram, self->pc++);
-                logByte(dis, 3, arg1);
-                logZpInd(dis, arg1);
-                if (self->pc >= Ram_size(self->ram)) rc = -1;
-                if ((size_t)arg1 + 1 > Ram_size(self->ram)) return -1;
-                ind = Ram_get(self->ram, arg1) |
-                    Ram_get(self->ram, arg1 + 1) << 8;
-                addr = ind + self->regs[CR_Y];
-                break;
-        }
-        if (addr > Ram_size(self->ram)) return -1;
-        v = Ram_get(self->ram, addr);
-        switch (op & 0xf8)
-        {
-            case O_LDA:
-                logInst(dis, "LDA");
-                self->regs[CR_A] = v;
-                NZ(self->regs[CR_A]);
-                break;
-            case O_STA:
-                logInst(dis, "STA");
-                Ram_set(self->ram, addr, self->regs[CR_A]);
-                if (self->conv) Converter_writeData(self->conv,
-                        self->regs[CR_A], addr);
-                break;
-            case O_LDX:
-                logInst(dis, "LDX");
-                self->regs[CR_X] = v;
-                NZ(self->regs[CR_X]);
-                break;
-            case O_STX:
-                logInst(dis, "STX");
-                Ram_set(self->ram, addr, self->regs[CR_X]);
-                if (self->conv) Converter_writeData(self->conv,
-                        self->regs[CR_X], addr);
-                break;
-            case O_LDY:
-                logInst(dis, "LDY");
-                self->regs[CR_Y] = v;
-                NZ(self->regs[CR_Y]);
-                break;
-            case O_STY:
-                logInst(dis, "STY");
-                Ram_set(self->ram, addr, self->regs[CR_Y]);
-                if (self->conv) Converter_writeData(self->conv,
-                        self->regs[CR_Y], addr);
-                break;
-            case O_AND:
-                logInst(dis, "AND");
-                self->regs[CR_A] &= v;
-                NZ(self->regs[CR_A]);
-                break;
-            case O_ORA:
-                logInst(dis, "ORA");
-                self->regs[CR_A] |= v;
-                NZ(self->regs[CR_A]);
-                break;
-            case O_EOR:
-                logInst(dis, "EOR");
-                self->regs[CR_A] ^= v;
-                NZ(self->regs[CR_A]);
-                break;
-            case O_LSR:
-                logInst(dis, "LSR");
-                SR(v);
-                NZ(v);
-                Ram_set(self->ram, addr, v);
-                if (self->conv) Converter_writeData(self->conv, v, addr);
-                logRes(dis, v);
-                break;
-            case O_ASL:
-                logInst(dis, "ASL");
-                SL(v);
-                NZ(v);
-                Ram_set(self->ram, addr, v);
-                if (self->conv) Converter_writeData(self->conv, v, addr);
-                logRes(dis, v);
-                break;
-            case O_ROR:
-                logInst(dis, "ROR");
-                RR(v);
-                NZ(v);
-                Ram_set(self->ram, addr, v);
-                if (self->conv) Converter_writeData(self->conv, v, addr);
-                logRes(dis, v);
-                break;
-            case O_ROL:
-                logInst(dis, "ROL");
-                RL(v);
-                NZ(v);
-                Ram_set(self->ram, addr, v);
-                if (self->conv) Converter_writeData(self->conv, v, addr);
-                logRes(dis, v);
-                break;
-            case O_ADC:
-                logInst(dis, "ADC");
-                carry = self->flags & CF_CARRY;
-                self->regs[CR_A] += v;
-                if (self->regs[CR_A] >= v) self->flags &= ~CF_CARRY;
-                else self->flags |= CF_CARRY;
-                if (carry)
-                {
-                    if (!++self->regs[CR_A]) self->flags |= CF_CARRY;
-                }
-                NZ(self->regs[CR_A]);
-                break;
-            case O_SBC:
-                logInst(dis, "SBC");
-                carry = self->flags & CF_CARRY;
-                self->regs[CR_A] -= v;
-                if (self->regs[CR_A] <= v) self->flags |= CF_CARRY;
-                else self->flags &= ~CF_CARRY;
-                if (!carry)
-                {
-                    if (!self->regs[CR_A]--) self->flags &= ~CF_CARRY;
-                }
-                NZ(self->regs[CR_A]);
-                break;
-            case O_INC:
-                logInst(dis, "INC");
-                ++v;
-                NZ(v);
-                Ram_set(self->ram, addr, v);
-                if (self->conv) Converter_writeData(self->conv, v, addr);
-                logRes(dis, v);
-                break;
-            case O_DEC:
-                logInst(dis, "DEC");
-                --v;
-                NZ(v);
-                Ram_set(self->ram, addr, v);
-                if (self->conv) Converter_writeData(self->conv, v, addr);
-                logRes(dis, v);
-                break;
-            case O_CMP:
-                logInst(dis, "CMP");
-                v = self->regs[CR_A] - v;
-                if (v < self->regs[CR_A]) self->flags |= CF_CARRY;
-                else self->flags &= ~CF_CARRY;
-                NZ(v);
-                break;
-            case O_CPX:
-                logInst(dis, "CPX");
-                v = self->regs[CR_X] - v;
-                if (v < self->regs[CR_X]) self->flags |= CF_CARRY;
-                else self->flags &= ~CF_CARRY;
-                NZ(v);
-                break;
-            case O_CPY:
-                logInst(dis, "CPY");
-                v = self->regs[CR_Y] - v;
-                if (v < self->regs[CR_Y]) self->flags |= CF_CARRY;
-                else self->flags &= ~CF_CARRY;
-                NZ(v);
-                break;
-            case O_WUD:
-                logInst(dis, "WUD");
-                printf("%u", v);
-                fflush(stdout);
-                break;
-            case O_WSD:
-                logInst(dis, "WSD");
-                printf("%d", (int8_t)v);
-                fflush(stdout);
-                break;
-            case O_WCH:
-                logInst(dis, "WCH");
-                putchar(v);
-                fflush(stdout);
-                break;
-            case O_WTX:
-                logInst(dis, "WTX");
-                fputs((char *)Ram_contents(self->ram) + addr, stdout);
-                fflush(stdout);
-                break;
-            default:
-                logInst(dis, "ILL");
-                return -1;
-        }
+        Output_destroy(self->output);
+        self->output = output;
+        Output_setInterval(output, self->interval);
     }
-    return rc;
+    Input_tie(self->input, self->output);
+}
+
+Output *Cpu_output(const Cpu *self)
+{
+    return self->output;
 }
 
 uint16_t Cpu_pc(const Cpu *self)
@@ -693,7 +194,7 @@ uint16_t Cpu_pc(const Cpu *self)
 
 CpuFlags Cpu_flags(const Cpu *self)
 {
-    return self->flags;
+    return FLAGS(self->flags);
 }
 
 uint8_t Cpu_reg(const Cpu *self, CpuReg r)
@@ -703,6 +204,10 @@ uint8_t Cpu_reg(const Cpu *self, CpuReg r)
 
 void Cpu_destroy(Cpu *self)
 {
+    if (!self) return;
+    Verifier_destroy(self->verifier);
+    Input_destroy(self->input);
+    Output_destroy(self->output);
     free(self);
 }
 
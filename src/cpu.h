@@ -20,9 +20,26 @@ typedef enum CpuReg
 typedef struct Cpu Cpu;
 typedef struct Ram Ram;
 typedef struct Converter Converter;
+typedef struct Input Input;
+typedef struct Output Output;
+typedef struct Tracer Tracer;
 
 Cpu *Cpu_create(Ram *ram, uint16_t pc, Converter *conv);
 int Cpu_step(Cpu *self, char *dis);
+int Cpu_run(Cpu *self, uint64_t maxSteps);
+/* runs with a trace record for every instruction, Cpu_step() with dis
+ * writes the disassembly there instead (32 bytes) */
+void Cpu_setTrace(Cpu *self, Tracer *tracer);
+/* Interactive output (the default) is flushed after every instruction.
+ * Otherwise, it's flushed before reading input, when the stdout buffer is
+ * full, and unless interval is 0, by the first output after interval
+ * milliseconds passed since the last flush. */
+void Cpu_setOutput(Cpu *self, int interactive, unsigned interval);
+/* Replaces the input and output the CPU owns, 0 keeps the current one. The
+ * default reads stdin with a buffer of 1 byte, so the program doesn't
+ * consume input it doesn't read, and writes to stdout. */
+void Cpu_setIo(Cpu *self, Input *input, Output *output);
+Output *Cpu_output(const Cpu *self);
 uint16_t Cpu_pc(const Cpu *self);
 CpuFlags Cpu_flags(const Cpu *self);
 uint8_t Cpu_reg(const Cpu *self, CpuReg r);
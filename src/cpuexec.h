@@ -0,0 +1,454 @@
+/* Template for the instruction interpreter, included by cpu.c once for each
+ * variant. Before including, define EXEC_STEP and optionally EXEC_RUN to the
+ * names of the functions to generate, and optionally EXEC_TRACE (record
+ * every instruction for the Tracer) or EXEC_CONV (run with a converter attached).
+ * Without these, the generated code contains no tracing or conversion code
+ * at all. EXEC_UNCHECKED removes all range checks, which are redundant
+ * for a full 64KB image and for instructions the Verifier found safe.
+ * EXEC_FLAT implies it and accesses a full image materialized with
+ * Ram_data() directly, so a read is a single load.
+ *
+ * Every opcode has a handler of its own, generated from the instruction set
+ * in opcode.h where possible. With GNU C, the handlers are labels found in a
+ * table indexed by the opcode, otherwise they are the cases of one switch.
+ * Either way, an instruction is dispatched with a single indexed jump.
+ */
+
+#ifndef CPUEXEC_HANDLERS
+#define CPUEXEC_HANDLERS
+
+#ifdef __GNUC__
+#define HANDLER(l, v) L_##l
+#define ILLEGAL L_ILLEGAL
+/* offsets from L_ILLEGAL, so opcodes missing in the table are illegal */
+#define T_MODE(n, v, m, size) [(v) | O_AM_##m] = &&L_##n##_##m - &&L_ILLEGAL,
+#define T_MM(n, v) ISA_MODES(T_MODE, n, v)
+#define T_IMP(n, v) [v] = &&L_##n - &&L_ILLEGAL,
+#define T_BR(n, v) \
+    [(v) | O_AM_RELATIVE] = &&L_##n##_REL - &&L_ILLEGAL, \
+    [(v) | O_AM_ABSOLUTE] = &&L_##n##_ABS - &&L_ILLEGAL,
+#else
+#define HANDLER(l, v) case v
+#define ILLEGAL default
+#endif
+
+#define EA_IMMEDIATE \
+    arg1 = GET(self->pc); \
+    LOG(traceByte(rec, arg1)); \
+    LOG(traceOperand(rec)); \
+    addr = self->pc++; \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) rc = -1
+
+#define EA_ABS(r) \
+    arg1 = GET(self->pc++); \
+    LOG(traceByte(rec, arg1)); \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) return -1; \
+    arg2 = GET(self->pc++); \
+    LOG(traceByte(rec, arg2)); \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) rc = -1; \
+    addr = (arg2 << 8 | arg1) r; \
+    LOG(traceOperand(rec))
+
+#define EA_ZP(r) \
+    arg1 = GET(self->pc++); \
+    LOG(traceByte(rec, arg1)); \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) rc = -1; \
+    addr = arg1 r; \
+    LOG(traceOperand(rec))
+
+#define EA_ABSOLUTE EA_ABS()
+#define EA_ZP_ABS EA_ZP()
+#define EA_IDX_X EA_ABS(+ self->regs[CR_X])
+#define EA_ZP_IDX_X EA_ZP(+ self->regs[CR_X])
+#define EA_IDX_Y EA_ABS(+ self->regs[CR_Y])
+#define EA_ZP_IDX_Y EA_ZP(+ self->regs[CR_Y])
+
+#define EA_ZP_IND_Y \
+    arg1 = GET(self->pc++); \
+    LOG(traceByte(rec, arg1)); \
+    LOG(traceOperand(rec)); \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) rc = -1; \
+    if (CHECKED((size_t)arg1 + 1 > Ram_size(self->ram))) return -1; \
+    ind = GET(arg1) | GET(arg1 + 1) << 8; \
+    addr = ind + self->regs[CR_Y]
+
+#define OP_LOAD(r) \
+    self->regs[r] = GET(addr); \
+    NZ(self->flags, self->regs[r])
+
+#define OP_STORE(r) \
+    SET(addr, self->regs[r]); \
+    CONV(Converter_writeData(self->conv, self->regs[r], addr))
+
+#define OP_LOGIC(o) \
+    self->regs[CR_A] o GET(addr); \
+    NZ(self->flags, self->regs[CR_A])
+
+#define OP_MODIFY(x) \
+    v = GET(addr); \
+    x; \
+    NZ(self->flags, v); \
+    SET(addr, v); \
+    CONV(Converter_writeData(self->conv, v, addr)); \
+    LOG(traceResult(rec, v))
+
+#define OP_LDA OP_LOAD(CR_A)
+#define OP_STA OP_STORE(CR_A)
+#define OP_LDX OP_LOAD(CR_X)
+#define OP_STX OP_STORE(CR_X)
+#define OP_LDY OP_LOAD(CR_Y)
+#define OP_STY OP_STORE(CR_Y)
+#define OP_AND OP_LOGIC(&=)
+#define OP_ORA OP_LOGIC(|=)
+#define OP_EOR OP_LOGIC(^=)
+#define OP_LSR OP_MODIFY(SR(self->flags, v))
+#define OP_ASL OP_MODIFY(SL(self->flags, v))
+#define OP_ROR OP_MODIFY(RR(self->flags, v))
+#define OP_ROL OP_MODIFY(RL(self->flags, v))
+#define OP_ADC v = GET(addr); ADC(self->flags, self->regs[CR_A], v)
+#define OP_SBC v = GET(addr); SBC(self->flags, self->regs[CR_A], v)
+#define OP_INC OP_MODIFY(++v)
+#define OP_DEC OP_MODIFY(--v)
+#define OP_CMP v = GET(addr); CMP(self->flags, self->regs[CR_A], v)
+#define OP_CPX v = GET(addr); CMP(self->flags, self->regs[CR_X], v)
+#define OP_CPY v = GET(addr); CMP(self->flags, self->regs[CR_Y], v)
+#define OP_WUD writeDecimal(self, GET(addr)); outputDone(self)
+#define OP_WSD \
+    v = GET(addr); \
+    if (v & 0x80) \
+    { \
+        Output_putc(self->output, '-'); \
+        v = -v; \
+    } \
+    writeDecimal(self, v); \
+    outputDone(self)
+#define OP_WCH Output_putc(self->output, GET(addr)); outputDone(self)
+#define OP_WTX Ram_puts(self->ram, addr, self->output); outputDone(self)
+
+#define MM_HANDLER(n, v, m, size) \
+    HANDLER(n##_##m, (v) | O_AM_##m): \
+        if (rc) return rc; \
+        EA_##m; \
+        if (CHECKED(addr > Ram_size(self->ram))) return -1; \
+        OP_##n; \
+        return rc;
+#define MM_HANDLERS(n, v) ISA_MODES(MM_HANDLER, n, v)
+
+#define BR_RELATIVE \
+    arg1 = GET(self->pc++); \
+    LOG(traceByte(rec, arg1)); \
+    diff = (int8_t) arg1; \
+    LOG(traceOperand(rec)); \
+    if (self->pc + diff < 0) return -1; \
+    target = self->pc + diff
+
+#define BR_ABSOLUTE \
+    arg1 = GET(self->pc++); \
+    LOG(traceByte(rec, arg1)); \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) return -1; \
+    arg2 = GET(self->pc++); \
+    LOG(traceByte(rec, arg2)); \
+    target = arg2 << 8 | arg1; \
+    LOG(traceOperand(rec))
+
+#define BR_JUMP do { \
+    if (CHECKED(target >= Ram_size(self->ram))) return -1; \
+    self->pc = target; \
+} while (0)
+
+#define BR_BSR \
+    if (self->sp == 256) return -1; \
+    self->stack[self->sp++] = self->pc & 0xff; \
+    if (self->sp == 256) return -1; \
+    self->stack[self->sp++] = self->pc >> 8; \
+    BR_JUMP
+#define BR_BRA BR_JUMP
+#define BR_BNE if (!FLAG_Z(self->flags)) BR_JUMP
+#define BR_BEQ if (FLAG_Z(self->flags)) BR_JUMP
+#define BR_BPL if (!FLAG_N(self->flags)) BR_JUMP
+#define BR_BMI if (FLAG_N(self->flags)) BR_JUMP
+#define BR_BCC if (!FLAG_C(self->flags)) BR_JUMP
+#define BR_BCS if (FLAG_C(self->flags)) BR_JUMP
+
+#define BR_HANDLERS(n, v) \
+    HANDLER(n##_REL, (v) | O_AM_RELATIVE): \
+        if (rc) return rc; \
+        BR_RELATIVE; \
+        BR_##n; \
+        return 0; \
+    HANDLER(n##_ABS, (v) | O_AM_ABSOLUTE): \
+        if (rc) return rc; \
+        BR_ABSOLUTE; \
+        BR_##n; \
+        return 0;
+
+#define IMP_TRANSFER(from, to) \
+    self->regs[to] = self->regs[from]; \
+    NZ(self->flags, self->regs[to]); \
+    return rc
+
+#define IMP_PUSH(r) \
+    if (self->sp == 256) return -1; \
+    self->stack[self->sp++] = self->regs[r]; \
+    return rc
+
+#define IMP_PULL(r) \
+    if (self->sp == 0) return -1; \
+    self->regs[r] = self->stack[--self->sp]; \
+    return rc
+
+/* RTX, RBK and WBK take the page of their buffer */
+#define IMP_PAGE \
+    u = GET(self->pc++); \
+    LOG(traceByte(rec, u)); \
+    if (CHECKED(self->pc >= Ram_size(self->ram))) return -1; \
+    LOG(traceOperand(rec))
+
+#endif
+
+#ifdef EXEC_TRACE
+#define LOG(x) x
+#define CONV(x) if (self->conv) x
+#elif defined(EXEC_CONV)
+#define LOG(x)
+#define CONV(x) x
+#else
+#define LOG(x)
+#define CONV(x)
+#endif
+
+#ifdef EXEC_FLAT
+#define CHECKED(c) 0
+#define GET(at) (flat[(uint16_t)(at)])
+#define SET(at, v) Ram_setFlat(self->ram, flat, (at), (v))
+#elif defined(EXEC_UNCHECKED)
+#define CHECKED(c) 0
+#define GET(at) Ram_getFast(self->ram, (at))
+#define SET(at, v) Ram_setFast(self->ram, (at), (v))
+#else
+#define CHECKED(c) (c)
+#define GET(at) Ram_get(self->ram, (at))
+#define SET(at, v) Ram_set(self->ram, (at), (v))
+#endif
+
+static inline int EXEC_STEP(Cpu *self, TraceRecord *rec)
+{
+    (void)rec;
+#ifdef EXEC_FLAT
+    uint8_t *flat = self->ram->flat;
+#endif
+#ifdef __GNUC__
+    static const int handlers[256] = {
+        ISA_MULTIMODE(T_MM)
+        ISA_IMPLICIT(T_IMP)
+        ISA_BRANCH(T_BR)
+    };
+#endif
+    uint8_t arg1, arg2, v, n;
+    uint16_t addr, ind, target;
+    int8_t diff;
+    uint8_t buf[INPUT_LINESIZE];
+    size_t len;
+    unsigned u;
+    int s;
+
+    LOG(traceStart(self, rec));
+    int rc = 0;
+    uint8_t op = GET(self->pc);
+    CONV(Converter_writeOpcode(self->conv, op, self->pc));
+    ++self->pc;
+    if (CHECKED(self->pc >= Ram_size(self->ram))) rc = -1;
+    LOG(traceByte(rec, op));
+
+#ifdef __GNUC__
+    goto *(&&L_ILLEGAL + handlers[op]);
+#else
+    switch (op)
+#endif
+    {
+        ISA_MULTIMODE(MM_HANDLERS)
+        ISA_BRANCH(BR_HANDLERS)
+
+        HANDLER(RTS, O_RTS):
+            if (self->sp == 0) return -1;
+            self->pc = self->stack[--self->sp] << 8;
+            if (self->sp == 0) return -1;
+            self->pc |= self->stack[--self->sp];
+            if (CHECKED(self->pc >= Ram_size(self->ram))) return -1;
+            return rc;
+        HANDLER(SRA, O_SRA):
+            SR(self->flags, self->regs[CR_A]);
+            NZ(self->flags, self->regs[CR_A]);
+            return rc;
+        HANDLER(SLA, O_SLA):
+            SL(self->flags, self->regs[CR_A]);
+            NZ(self->flags, self->regs[CR_A]);
+            return rc;
+        HANDLER(RRA, O_RRA):
+            RR(self->flags, self->regs[CR_A]);
+            NZ(self->flags, self->regs[CR_A]);
+            return rc;
+        HANDLER(RLA, O_RLA):
+            RL(self->flags, self->regs[CR_A]);
+            NZ(self->flags, self->regs[CR_A]);
+            return rc;
+        HANDLER(INA, O_INA):
+            ++self->regs[CR_A];
+            NZ(self->flags, self->regs[CR_A]);
+            return rc;
+        HANDLER(DEA, O_DEA):
+            --self->regs[CR_A];
+            NZ(self->flags, self->regs[CR_A]);
+            return rc;
+        HANDLER(INX, O_INX):
+            ++self->regs[CR_X];
+            NZ(self->flags, self->regs[CR_X]);
+            return rc;
+        HANDLER(DEX, O_DEX):
+            --self->regs[CR_X];
+            NZ(self->flags, self->regs[CR_X]);
+            return rc;
+        HANDLER(INY, O_INY):
+            ++self->regs[CR_Y];
+            NZ(self->flags, self->regs[CR_Y]);
+            return rc;
+        HANDLER(DEY, O_DEY):
+            --self->regs[CR_Y];
+            NZ(self->flags, self->regs[CR_Y]);
+            return rc;
+        HANDLER(SEZ, O_SEZ):
+            SEZ(self->flags);
+            return rc;
+        HANDLER(CLZ, O_CLZ):
+            CLZ(self->flags);
+            return rc;
+        HANDLER(SEN, O_SEN):
+            SEN(self->flags);
+            return rc;
+        HANDLER(CLN, O_CLN):
+            CLN(self->flags);
+            return rc;
+        HANDLER(SEC, O_SEC):
+            SEC(self->flags);
+            return rc;
+        HANDLER(CLC, O_CLC):
+            CLC(self->flags);
+            return rc;
+        HANDLER(TAX, O_TAX):
+            IMP_TRANSFER(CR_A, CR_X);
+        HANDLER(TXA, O_TXA):
+            IMP_TRANSFER(CR_X, CR_A);
+        HANDLER(TAY, O_TAY):
+            IMP_TRANSFER(CR_A, CR_Y);
+        HANDLER(TYA, O_TYA):
+            IMP_TRANSFER(CR_Y, CR_A);
+        HANDLER(TXY, O_TXY):
+            IMP_TRANSFER(CR_X, CR_Y);
+        HANDLER(TYX, O_TYX):
+            IMP_TRANSFER(CR_Y, CR_X);
+        HANDLER(PHA, O_PHA):
+            IMP_PUSH(CR_A);
+        HANDLER(PLA, O_PLA):
+            IMP_PULL(CR_A);
+        HANDLER(PHX, O_PHX):
+            IMP_PUSH(CR_X);
+        HANDLER(PLX, O_PLX):
+            IMP_PULL(CR_X);
+        HANDLER(PHY, O_PHY):
+            IMP_PUSH(CR_Y);
+        HANDLER(PLY, O_PLY):
+            IMP_PULL(CR_Y);
+        HANDLER(WNL, O_WNL):
+            Output_putc(self->output, '\n');
+            outputDone(self);
+            return rc;
+        HANDLER(WTB, O_WTB):
+            Output_putc(self->output, '\t');
+            outputDone(self);
+            return rc;
+        HANDLER(WSP, O_WSP):
+            Output_putc(self->output, ' ');
+            outputDone(self);
+            return rc;
+        HANDLER(RUD, O_RUD):
+        HANDLER(RSD, O_RSD):
+            n = 0;
+            if (Input_getNumber(self->input, op == O_RSD, &n) < 0) return -1;
+            self->regs[CR_A] = n;
+            LOG(traceResult(rec, self->regs[CR_A]));
+            return rc;
+        HANDLER(RCH, O_RCH):
+            s = Input_getc(self->input);
+            if (s < 0) return -1;
+            self->regs[CR_A] = s;
+            LOG(traceResult(rec, self->regs[CR_A]));
+            return rc;
+        HANDLER(RTX, O_RTX):
+            IMP_PAGE;
+            if (!Input_gets(self->input, (char *)buf, INPUT_LINESIZE))
+            {
+                return -1;
+            }
+            buf[strcspn((char *)buf, "\n")] = 0;
+            len = strlen((char *)buf)+1;
+            if (len > 256)
+            {
+                len = 256;
+                buf[255] = 0;
+            }
+            if (Ram_load(self->ram, u<<8, buf, len) < 0) return -1;
+            return rc;
+        HANDLER(RBK, O_RBK):
+            IMP_PAGE;
+            len = self->regs[CR_X] ? self->regs[CR_X] : 256;
+            if ((u<<8) + len > Ram_size(self->ram)) return -1;
+            len = Input_read(self->input, buf, len);
+            if (Ram_load(self->ram, u<<8, buf, len) < 0) return -1;
+            self->regs[CR_X] = len;
+            self->flags.carry = !len;
+            LOG(traceResult(rec, self->regs[CR_X]));
+            return rc;
+        HANDLER(WBK, O_WBK):
+            IMP_PAGE;
+            len = self->regs[CR_X] ? self->regs[CR_X] : 256;
+            if (Ram_write(self->ram, u<<8, len, self->output) < 0) return -1;
+            outputDone(self);
+            return rc;
+        HANDLER(HLT, O_HLT):
+        ILLEGAL:
+            return -1;
+    }
+}
+
+#ifdef EXEC_RUN
+static int EXEC_RUN(Cpu *self, uint64_t maxSteps)
+{
+#ifdef EXEC_TRACE
+    TraceRecord rec;
+    int rc;
+#endif
+    do
+    {
+#ifdef EXEC_TRACE
+        rc = EXEC_STEP(self, &rec);
+        Tracer_push(self->tracer, &rec);
+        if (rc < 0) return rc;
+#else
+        if (EXEC_STEP(self, 0) < 0) return -1;
+#endif
+    } while (--maxSteps);
+    return 0;
+}
+#endif
+
+#undef LOG
+#undef CONV
+#undef CHECKED
+#undef GET
+#undef SET
+#undef EXEC_STEP
+#undef EXEC_RUN
+#undef EXEC_TRACE
+#undef EXEC_CONV
+#undef EXEC_UNCHECKED
+#undef EXEC_FLAT
@@ -0,0 +1,109 @@
+#ifndef CPUIMPL_H
+#define CPUIMPL_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+typedef struct Verifier Verifier;
+typedef struct Tracer Tracer;
+typedef struct Input Input;
+typedef struct Output Output;
+
+/* Z and N are evaluated lazily: most results are overwritten before a
+ * branch looks at them, so instructions only record the result byte. Z is
+ * set if zres is 0, N is set if bit 7 of nres is set. These are separate
+ * bytes because SEZ/CLZ/SEN/CLN change only one of the flags.
+ */
+typedef struct LazyFlags
+{
+    uint8_t zres;
+    uint8_t nres;
+    uint8_t carry;
+} LazyFlags;
+
+struct Cpu
+{
+    Ram *ram;
+    Converter *conv;
+    Verifier *verifier;
+    Tracer *tracer;
+    Input *input;
+    Output *output;
+    int interactive;
+    unsigned interval;
+    LazyFlags flags;
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t stack[256];
+    uint8_t regs[3];
+};
+
+#define FLAG_Z(f) (!(f).zres)
+#define FLAG_N(f) ((f).nres & 0x80)
+#define FLAG_C(f) ((f).carry)
+
+#define FLAGS(f) ((FLAG_Z(f) ? CF_ZERO : 0) \
+        | (FLAG_N(f) ? CF_NEGATIVE : 0) \
+        | (FLAG_C(f) ? CF_CARRY : 0))
+
+#define SEZ(f) ((f).zres = 0)
+#define CLZ(f) ((f).zres = 1)
+#define SEN(f) ((f).nres = 0x80)
+#define CLN(f) ((f).nres = 0)
+#define SEC(f) ((f).carry = 1)
+#define CLC(f) ((f).carry = 0)
+
+#define SR(f, x) do { \
+    (f).carry = (x) & 1; \
+    (x) >>= 1; \
+} while(0)
+
+#define SL(f, x) do { \
+    (f).carry = !!((x) & 0x80); \
+    (x) <<= 1; \
+} while(0)
+
+#define RR(f, x) do { \
+    uint8_t c_ = (f).carry << 7; \
+    (f).carry = (x) & 1; \
+    (x) = (x) >> 1 | c_; \
+} while(0)
+
+#define RL(f, x) do { \
+    uint8_t c_ = (f).carry; \
+    (f).carry = !!((x) & 0x80); \
+    (x) = (x) << 1 | c_; \
+} while(0)
+
+#define NZ(f, x) ((f).zres = (f).nres = (x))
+
+#define ADC(f, r, v) do { \
+    int c_ = (f).carry; \
+    (r) += (v); \
+    (f).carry = (r) < (v); \
+    if (c_) \
+    { \
+        if (!++(r)) (f).carry = 1; \
+    } \
+    NZ(f, r); \
+} while(0)
+
+#define SBC(f, r, v) do { \
+    int c_ = (f).carry; \
+    (r) -= (v); \
+    (f).carry = (r) <= (v); \
+    if (!c_) \
+    { \
+        if (!(r)--) (f).carry = 0; \
+    } \
+    NZ(f, r); \
+} while(0)
+
+#define CMP(f, r, v) do { \
+    uint8_t d_ = (r) - (v); \
+    (f).carry = d_ < (r); \
+    NZ(f, d_); \
+} while(0)
+
+#endif
@@ -4,19 +4,26 @@
 
 void showusage(const char *prg)
 {
-    fprintf(stderr, "Usage: %s [-r] [-s startpc] [-h] [-t] [-c convfile] "
-            "[-d] [-x] <program>\n"
+    fprintf(stderr, "Usage: %s [-r] [-s startpc] [-h] [-t|-T] [-i] [-j] [-f] "
+            "[-c convfile] [-d] [-x] [-w] [-S snapshot] [-l]\n"
+	    "       [-m devbase] [-b nbanks] [-u] [-F interval] [-I infile] "
+	    "[-O outfile]\n"
+	    "       <program>\n"
 	    "       %s asm <source>\n"
+	    "       %s aot [-r] [-s startpc] [-h] <program>\n"
 	    "       %s -?|-h|--help\n"
-	    , prg, prg, prg);
+	    , prg, prg, prg, prg);
 }
 
 void showhelp(const char *prg)
 {
     fprintf(stderr, "GVM 0.0a1 - an 8bit virtual machine\n"
 	    "Felix Palmen <felix@palmen-it.de>\n\n"
-	    " %s [-r] [-s startpc] [-h] [-t] [-c convfile] "
-	    "[-d] [-x] <program>\n"
+	    " %s [-r] [-s startpc] [-h] [-t|-T] [-i] [-j] [-f] [-c convfile] "
+	    "[-d] [-x]\n"
+	    "    [-w] [-S snapshot] [-l] [-m devbase] [-b nbanks] [-u] "
+	    "[-F interval]\n"
+	    "    [-I infile] [-O outfile] <program>\n"
 	    "    Run a program in the virtual machine.\n\n"
 	    "    -r: input is the whole RAM (default: input is a program to "
 	    "load into\n"
@@ -25,17 +32,77 @@ void showhelp(const char *prg)
 	    "normal mode,\n"
 	    "                0 in -r mode)\n"
 	    "    -h: input is a hex file (default: binary)\n"
-	    "    -t: enable tracing of execution to stderr\n"
+	    "    -t: enable tracing of execution to stderr, written by a "
+	    "separate thread\n"
+	    "        where the platform supports it\n"
+	    "    -T: like -t, but drop trace records instead of waiting when "
+	    "the writer\n"
+	    "        thread falls behind, and report how many were dropped\n"
+	    "    -i: always use the plain interpreter (default: run predecoded\n"
+	    "        threaded code unless tracing or converting)\n"
+	    "    -j: compile to native code where supported (x86_64, 64KB RAM)\n"
+	    "    -f: show statistics about fused instruction sequences in "
+	    "threaded code\n"
+	    "        and writes to pages holding predecoded or compiled code\n"
 	    "    -c convfile: translate program to a different set of opcodes "
 	    "given in\n"
 	    "                 <convfile> during execution\n"
 	    "    -d: dump final contents of RAM in binary\n"
 	    "    -x: dump final contents of RAM in hex\n"
+	    "    -w: dump bytes of RAM changed by the program in hex, one line "
+	    "per run\n"
+	    "        of changed bytes, prefixed with its address\n"
+	    "    -S snapshot: save the machine state to <snapshot> right before "
+	    "the first\n"
+	    "                 instruction reading input, then continue "
+	    "(can't be used\n"
+	    "                 with -c or -b). Output written up to that point "
+	    "is saved\n"
+	    "                 with it.\n"
+	    "    -l: input is a snapshot saved with -S, execution resumes "
+	    "where it was\n"
+	    "        saved after writing the output saved with it (-r, -s and "
+	    "-h don't\n"
+	    "        apply)\n"
+	    "    -m devbase: map I/O devices to RAM at <devbase>, stores to "
+	    "these\n"
+	    "                addresses (relative to <devbase>) do I/O:\n"
+	    "                0: write the byte to the output\n"
+	    "                1: write n bytes (0 means 256) from the buffer "
+	    "at $100\n"
+	    "                2: put milliseconds since start to 4-7 (little "
+	    "endian)\n"
+	    "    -b nbanks: add 2 to 256 banks of 16KB to a 64KB RAM, a store "
+	    "to $ffff\n"
+	    "               selects the bank seen at $8000-$bfff. In -r mode, "
+	    "input\n"
+	    "               beyond 64KB fills banks 1 and up. Dumps include "
+	    "all banks.\n"
+	    "    -u: interactive I/O: flush output after every instruction and "
+	    "read input\n"
+	    "        unbuffered, so nothing the program doesn't read is "
+	    "consumed (default:\n"
+	    "        buffer input and output, flush output before reading "
+	    "input, when\n"
+	    "        the buffer is full and at exit)\n"
+	    "    -F interval: also flush output when the program writes "
+	    "output (to\n"
+	    "                 devices as well) and <interval> milliseconds "
+	    "passed since\n"
+	    "                 the last flush\n"
+	    "    -I infile: read the program's input from <infile> "
+	    "(default: stdin)\n"
+	    "    -O outfile: write the program's output to <outfile> "
+	    "(default: stdout)\n"
 	    "    <program>: the program to load or the RAM to use in -r mode\n"
 	    "\n"
 	    " %s asm <source>\n"
 	    "    Assemble <source> to binary bytecode\n\n"
+	    " %s aot [-r] [-s startpc] [-h] <program>\n"
+	    "    Translate <program> to a C program on stdout. -r, -s and -h "
+	    "work like\n"
+	    "    above. Self-modifying code continues in an interpreter.\n\n"
 	    " %s -?|-h|--help\n"
 	    "    Show this help message\n"
-	    , prg, prg, prg);
+	    , prg, prg, prg, prg);
 }
@@ -0,0 +1,143 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hexreader.h"
+
+#define BUFSIZE 0x10000
+
+/* Newlines can only occur between numbers, so the line is counted there
+ * and the column is calculated from the offset of the line start.
+ */
+
+struct HexReader
+{
+    FILE *in;
+    size_t pos;
+    size_t len;
+    size_t offset;
+    size_t linestart;
+    unsigned line;
+    size_t erroffset;
+    unsigned errline;
+    uint8_t buf[BUFSIZE];
+};
+
+static signed char nibble[256];
+
+static void initNibbles(void)
+{
+    if (nibble[0]) return;
+    for (int c = 0; c < 256; ++c) nibble[c] = -1;
+    for (int i = 0; i < 10; ++i) nibble['0' + i] = i;
+    for (int i = 0; i < 6; ++i) nibble['a' + i] = nibble['A' + i] = 10 + i;
+}
+
+static int peek(HexReader *self)
+{
+    if (self->pos == self->len)
+    {
+        self->offset += self->len;
+        self->pos = 0;
+        self->len = fread(self->buf, 1, BUFSIZE, self->in);
+        if (!self->len) return -1;
+    }
+    return self->buf[self->pos];
+}
+
+static int next(HexReader *self)
+{
+    ++self->pos;
+    return peek(self);
+}
+
+static int digit(int c)
+{
+    return c < 0 ? -1 : nibble[c];
+}
+
+static long fail(HexReader *self, size_t at, unsigned line)
+{
+    self->erroffset = at;
+    self->errline = line;
+    return -1;
+}
+
+HexReader *HexReader_create(FILE *in)
+{
+    HexReader *self = malloc(sizeof *self);
+    if (!self) return 0;
+    initNibbles();
+    self->in = in;
+    self->pos = 0;
+    self->len = 0;
+    self->offset = 0;
+    self->linestart = 0;
+    self->line = 1;
+    self->errline = 0;
+    return self;
+}
+
+long HexReader_read(HexReader *self, uint8_t *buf, size_t size)
+{
+    size_t n = 0;
+    int c = peek(self);
+
+    while (n < size)
+    {
+        while (c == ' ' || (c >= '\t' && c <= '\r'))
+        {
+            if (c == '\n')
+            {
+                ++self->line;
+                self->linestart = self->offset + self->pos + 1;
+            }
+            c = next(self);
+        }
+        if (c < 0) break;
+
+        size_t at = self->offset + self->pos;
+        int neg = c == '-';
+        if (neg || c == '+') c = next(self);
+        int digits = 0;
+        if (c == '0')
+        {
+            digits = 1;
+            c = next(self);
+            /* like fscanf(), a prefix without digits reads as 0 */
+            if (c == 'x' || c == 'X') c = next(self);
+        }
+        unsigned v = 0;
+        for (int d; (d = digit(c)) >= 0; c = next(self))
+        {
+            digits = 1;
+            if (v <= 0xff) v = 16 * v + d;
+        }
+        if (!digits || (neg ? v != 0 : v > 0xff))
+        {
+            return fail(self, at, self->line);
+        }
+        buf[n++] = v;
+    }
+    if (ferror(self->in))
+    {
+        return fail(self, self->offset + self->pos, self->line);
+    }
+    return n;
+}
+
+unsigned HexReader_line(const HexReader *self)
+{
+    return self->errline ? self->errline : self->line;
+}
+
+unsigned HexReader_column(const HexReader *self)
+{
+    size_t at = self->errline ? self->erroffset : self->offset + self->pos;
+    return at - self->linestart + 1;
+}
+
+void HexReader_destroy(HexReader *self)
+{
+    free(self);
+}
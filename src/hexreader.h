@@ -0,0 +1,22 @@
+#ifndef HEXREADER_H
+#define HEXREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct HexReader HexReader;
+
+HexReader *HexReader_create(FILE *in);
+/* Decodes up to size bytes written as hex numbers separated by whitespace,
+ * accepting the same numbers as scanf() with "%x". Returns the number of
+ * bytes decoded, which is less than size only at the end of the input, or
+ * -1 on a number that doesn't fit in a byte, invalid input or a read
+ * error. */
+long HexReader_read(HexReader *self, uint8_t *buf, size_t size);
+/* the position of the error, or where reading stopped, starting at 1 */
+unsigned HexReader_line(const HexReader *self);
+unsigned HexReader_column(const HexReader *self);
+void HexReader_destroy(HexReader *self);
+
+#endif
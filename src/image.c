@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* The mapping is private, so the pages are shared with the page cache and
+ * nothing is copied until the Ram using them is written to. Files that
+ * can't be mapped (like pipes) are read instead.
+ */
+
+struct Image
+{
+    uint8_t *data;
+    size_t size;
+    int mapped;
+};
+
+static int readAll(Image *self, FILE *f, size_t maxsize)
+{
+    size_t size = 0;
+    for (;;)
+    {
+        if (self->size == size)
+        {
+            if (size > maxsize) return -1;
+            size = size ? 2 * size : 0x10000;
+            uint8_t *data = realloc(self->data, size);
+            if (!data) return -1;
+            self->data = data;
+        }
+        size_t sz = fread(self->data + self->size, 1, size - self->size, f);
+        if (!sz) break;
+        self->size += sz;
+    }
+    if (ferror(f) || self->size > maxsize) return -1;
+    return 0;
+}
+
+Image *Image_open(const char *path, size_t maxsize)
+{
+    Image *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) goto error;
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        goto error;
+    }
+    if (S_ISREG(st.st_mode))
+    {
+        self->size = st.st_size;
+        if (self->size && self->size <= maxsize)
+        {
+            self->data = mmap(0, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (self->size > maxsize || self->data == MAP_FAILED)
+        {
+            self->data = 0;
+            goto error;
+        }
+        self->mapped = !!self->data;
+        return self;
+    }
+    FILE *f = fdopen(fd, "rb");
+    if (!f)
+    {
+        close(fd);
+        goto error;
+    }
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) goto error;
+#endif
+    int rc = readAll(self, f, maxsize);
+    fclose(f);
+    if (rc < 0) goto error;
+    return self;
+
+error:
+    Image_close(self);
+    return 0;
+}
+
+const uint8_t *Image_data(const Image *self)
+{
+    return self->data;
+}
+
+size_t Image_size(const Image *self)
+{
+    return self->size;
+}
+
+void Image_close(Image *self)
+{
+    if (!self) return;
+#ifndef _WIN32
+    if (self->mapped) munmap(self->data, self->size);
+    else
+#endif
+    free(self->data);
+    free(self);
+}
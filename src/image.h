@@ -0,0 +1,15 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Image Image;
+
+/* maps a file read-only, or reads it where mapping isn't available */
+Image *Image_open(const char *path, size_t maxsize);
+const uint8_t *Image_data(const Image *self);
+size_t Image_size(const Image *self);
+void Image_close(Image *self);
+
+#endif
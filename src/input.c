@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#else
+#include <unistd.h>
+#endif
+
+#include "input.h"
+#include "output.h"
+
+/* Reads ahead as much as one read() returns, up to the buffer size. With a
+ * buffer of 1 byte, nothing is consumed beyond what the program reads. A
+ * stdio input reads ahead up to the end of a line, a memory input reads
+ * from the memory directly. The tied output is flushed before reading, as
+ * that's where the program might wait for input.
+ */
+
+typedef enum InputSource
+{
+    IS_FD,
+    IS_FILE,
+    IS_MEMORY
+} InputSource;
+
+struct Input
+{
+    InputSource source;
+    int fd;
+    FILE *file;
+    Output *tie;
+    size_t size;
+    size_t pos;
+    size_t len;
+    const uint8_t *buf;
+    uint8_t data[];
+};
+
+/* like read(), but stops after a newline so it doesn't wait for more */
+static long readFile(Input *self)
+{
+    long n = 0;
+    int c;
+    while ((size_t)n < self->size && (c = getc(self->file)) != EOF)
+    {
+        self->data[n++] = c;
+        if (c == '\n') break;
+    }
+    return n;
+}
+
+static int fill(Input *self)
+{
+    if (self->source == IS_MEMORY) return -1;
+    if (self->tie) Output_flush(self->tie);
+    long rc = self->source == IS_FD
+        ? read(self->fd, self->data, self->size) : readFile(self);
+    if (rc <= 0) return -1;
+    self->pos = 0;
+    self->len = rc;
+    return 0;
+}
+
+static Input *create(InputSource source, size_t size)
+{
+    if (!size) size = 1;
+    Input *self = malloc(sizeof *self + size);
+    if (!self) return 0;
+    self->source = source;
+    self->tie = 0;
+    self->size = size;
+    self->pos = 0;
+    self->len = 0;
+    self->buf = self->data;
+    return self;
+}
+
+Input *Input_create(int fd, size_t size)
+{
+    Input *self = create(IS_FD, size);
+    if (self) self->fd = fd;
+    return self;
+}
+
+Input *Input_createFile(FILE *file, size_t size)
+{
+    Input *self = create(IS_FILE, size);
+    if (self) self->file = file;
+    return self;
+}
+
+Input *Input_createMemory(const void *data, size_t size)
+{
+    Input *self = malloc(sizeof *self);
+    if (!self) return 0;
+    self->source = IS_MEMORY;
+    self->tie = 0;
+    self->size = size;
+    self->pos = 0;
+    self->len = size;
+    self->buf = data;
+    return self;
+}
+
+void Input_tie(Input *self, Output *output)
+{
+    self->tie = output;
+}
+
+int Input_getc(Input *self)
+{
+    if (self->pos == self->len && fill(self) < 0) return -1;
+    return self->buf[self->pos++];
+}
+
+char *Input_gets(Input *self, char *buf, size_t size)
+{
+    size_t n = 0;
+    if (!size) return 0;
+    while (n < size - 1)
+    {
+        if (self->pos == self->len && fill(self) < 0) break;
+        size_t chunk = self->len - self->pos;
+        if (chunk > size - 1 - n) chunk = size - 1 - n;
+        const uint8_t *from = self->buf + self->pos;
+        const uint8_t *nl = memchr(from, '\n', chunk);
+        if (nl) chunk = nl - from + 1;
+        memcpy(buf + n, from, chunk);
+        self->pos += chunk;
+        n += chunk;
+        if (nl) break;
+    }
+    if (!n) return 0;
+    buf[n] = 0;
+    return buf;
+}
+
+size_t Input_read(Input *self, uint8_t *buf, size_t size)
+{
+    if (!size) return 0;
+    if (self->pos == self->len)
+    {
+        /* don't read ahead when the buffer couldn't hold more anyways */
+        if (self->source == IS_FD && size >= self->size)
+        {
+            if (self->tie) Output_flush(self->tie);
+            long rc = read(self->fd, buf, size);
+            return rc > 0 ? (size_t)rc : 0;
+        }
+        if (fill(self) < 0) return 0;
+    }
+    size_t n = self->len - self->pos;
+    if (n > size) n = size;
+    memcpy(buf, self->buf + self->pos, n);
+    self->pos += n;
+    return n;
+}
+
+/* the next byte of a line read like fgets() with INPUT_LINESIZE bytes,
+ * -1 after the end of the line, *n counts the bytes read so far */
+static int lineByte(Input *self, size_t *n)
+{
+    if (*n == INPUT_LINESIZE - 1) return -1;
+    if (self->pos == self->len && fill(self) < 0) return -1;
+    int c = self->buf[self->pos++];
+    *n = c == '\n' ? INPUT_LINESIZE - 1 : *n + 1;
+    return c;
+}
+
+static int isSpace(int c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+int Input_getNumber(Input *self, int sign, uint8_t *value)
+{
+    size_t n = 0;
+    int c;
+
+    do c = lineByte(self, &n); while (isSpace(c));
+    if (c < 0) return -1;
+
+    int neg = c == '-';
+    if (neg || c == '+') c = lineByte(self, &n);
+    int digits = 0;
+    int overflow = 0;
+    unsigned long v = 0;
+    for (; c >= '0' && c <= '9'; c = lineByte(self, &n))
+    {
+        digits = 1;
+        if (v > (ULONG_MAX - (c - '0')) / 10) overflow = 1;
+        else v = 10 * v + (c - '0');
+    }
+    while (c >= 0) c = lineByte(self, &n);
+    if (!digits) return 0;
+
+    /* out of range values are clamped like strtoul() and strtol() do */
+    if (!sign)
+    {
+        if (overflow) v = ULONG_MAX;
+        else if (neg) v = -v;
+    }
+    else if (neg)
+    {
+        if (overflow || v > (unsigned long)LONG_MAX + 1) v = LONG_MIN;
+        else v = -v;
+    }
+    else if (overflow || v > LONG_MAX) v = LONG_MAX;
+    *value = v;
+    return 1;
+}
+
+void Input_destroy(Input *self)
+{
+    free(self);
+}
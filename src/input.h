@@ -0,0 +1,33 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define INPUT_LINESIZE 1024
+
+typedef struct Input Input;
+typedef struct Output Output;
+
+/* reads from fd with read() through a buffer of size bytes */
+Input *Input_create(int fd, size_t size);
+/* reads from file through a buffer of size bytes */
+Input *Input_createFile(FILE *file, size_t size);
+/* reads size bytes from data, which must stay valid as long as the input
+ * exists */
+Input *Input_createMemory(const void *data, size_t size);
+/* output is flushed before reading from a file or fd */
+void Input_tie(Input *self, Output *output);
+int Input_getc(Input *self);
+/* works like fgets() */
+char *Input_gets(Input *self, char *buf, size_t size);
+/* works like read(), returns 0 at the end of the input or on errors */
+size_t Input_read(Input *self, uint8_t *buf, size_t size);
+/* Reads a line like Input_gets() with INPUT_LINESIZE and parses a number
+ * in it like sscanf() with "%u", or "%d" if sign is set, without copying
+ * it. Returns sscanf()'s result and the low byte of the number. */
+int Input_getNumber(Input *self, int sign, uint8_t *value);
+void Input_destroy(Input *self);
+
+#endif
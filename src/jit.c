@@ -0,0 +1,927 @@
+#define _DEFAULT_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "jit.h"
+#include "cpuimpl.h"
+#include "ramimpl.h"
+#include "opcode.h"
+
+/* Basic block compiler to x86-64 machine code.
+ *
+ * A block is a straight sequence of instructions ending with a branch, RTS,
+ * or right before anything the compiler doesn't handle (I/O, HLT, illegal
+ * opcodes). While compiled code runs, the guest registers, flags and stack
+ * pointer live in host registers, and blocks jump to each other directly:
+ * every exit first goes through a stub returning to Jit_run(), which then
+ * patches the jump to point to the target block.
+ *
+ * Everything not compiled and all error conditions are executed by
+ * Cpu_step(), so the semantics are exactly the same. Stores check a map of
+ * bytes belonging to compiled blocks and return to Jit_run() when they hit
+ * one, so self-modifying code just invalidates the affected blocks. Pages
+ * with compiled code are also marked in the Ram, which reports writes done
+ * by Cpu_step(). Registers of devices mapped in the Ram are marked in the
+ * map as well, so stores to them reach the device through Ram_written().
+ *
+ * Only full 64KB images are supported, so no address can be out of range.
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32)
+
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define CODESIZE (4*1024*1024)
+#define MAXINSNS 128
+#define MAXINSNCODE 96
+#define MAXBLOCKCODE (MAXINSNS * 2 * MAXINSNCODE)
+#define HOTLIMIT 8
+
+enum reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* host register allocation while running compiled code */
+#define RMEM RBX    /* RAM base address */
+#define RCPU RBP    /* Cpu object */
+#define RJIT R15    /* Jit object */
+#define RA R12      /* accumulator */
+#define RX R13      /* X register */
+#define RY R14      /* Y register */
+#define RZ R8       /* zero flag is set if low byte is 0 */
+#define RN R9       /* negative flag is bit 7 */
+#define RC R10      /* carry flag, 0 or 1 */
+#define RS R11      /* stack pointer */
+
+enum exitreason
+{
+    EXIT_LINK,
+    EXIT_LOOKUP,
+    EXIT_INTERP,
+    EXIT_SMC
+};
+
+enum cc
+{
+    CC_B = 0x2,
+    CC_AE = 0x3,
+    CC_Z = 0x4,
+    CC_NZ = 0x5,
+    CC_BE = 0x6
+};
+
+typedef struct Block
+{
+    uint8_t *code;
+    uint32_t start;
+    uint32_t end;
+} Block;
+
+typedef struct Link
+{
+    uint8_t *field;
+    uint8_t *stub;
+    uint16_t target;
+} Link;
+
+typedef struct Stub
+{
+    uint8_t *field;
+    enum exitreason reason;
+    uint16_t pc;
+    int areg;
+    int32_t adisp;
+} Stub;
+
+typedef struct Mem
+{
+    int base;
+    int index;
+    int scale;
+    int32_t disp;
+} Mem;
+
+typedef int (*JitEntry)(Jit *jit, Cpu *cpu, uint8_t *ram, const uint8_t *code);
+
+struct Jit
+{
+    Cpu *cpu;
+    uint8_t *ram;
+    uint8_t *buf;
+    size_t used;
+    size_t base;
+    JitEntry enter;
+    uint8_t *epilogue;
+    uint8_t *lookup;
+    uintptr_t exitArg;
+    unsigned generation;
+    Block *blocks;
+    size_t nblocks;
+    size_t blockscapa;
+    Link *links;
+    size_t nlinks;
+    size_t linkscapa;
+    Stub stubs[2 * MAXINSNS + 1];
+    size_t nstubs;
+    uint8_t smccount[RAM_MAXSIZE];
+    uint8_t hot[RAM_MAXSIZE];
+    uint8_t codemap[RAM_MAXSIZE];
+    uint8_t *entry[RAM_MAXSIZE];
+};
+
+static void e8(Jit *j, uint8_t v)
+{
+    j->buf[j->used++] = v;
+}
+
+static void e32(Jit *j, uint32_t v)
+{
+    memcpy(j->buf + j->used, &v, 4);
+    j->used += 4;
+}
+
+static void e64(Jit *j, uint64_t v)
+{
+    memcpy(j->buf + j->used, &v, 8);
+    j->used += 8;
+}
+
+static void eop(Jit *j, unsigned op)
+{
+    if (op > 0xff) e8(j, op >> 8);
+    e8(j, op);
+}
+
+/* register form: op with ModRM.reg = reg, ModRM.rm = rm, always with REX */
+static void opRR(Jit *j, int w, unsigned op, int reg, int rm)
+{
+    e8(j, 0x40 | w << 3 | (reg >> 3) << 2 | rm >> 3);
+    eop(j, op);
+    e8(j, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+/* memory form: [base + index * 2^scale + disp32], index < 0 for none */
+static void opRM(Jit *j, int w, unsigned op, int reg, Mem m)
+{
+    int x = m.index < 0 ? 0 : m.index >> 3;
+    e8(j, 0x40 | w << 3 | (reg >> 3) << 2 | x << 1 | m.base >> 3);
+    eop(j, op);
+    if (m.index < 0)
+    {
+        e8(j, 0x80 | (reg & 7) << 3 | (m.base & 7));
+    }
+    else
+    {
+        e8(j, 0x84 | (reg & 7) << 3);
+        e8(j, m.scale << 6 | (m.index & 7) << 3 | (m.base & 7));
+    }
+    e32(j, m.disp);
+}
+
+static Mem mem(int base, int index, int32_t disp)
+{
+    Mem m = { base, index, 0, disp };
+    return m;
+}
+
+static void mov(Jit *j, int dst, int src)
+{
+    opRR(j, 0, 0x89, src, dst);
+}
+
+static void movImm(Jit *j, int dst, uint32_t imm)
+{
+    e8(j, 0x40 | dst >> 3);
+    e8(j, 0xb8 + (dst & 7));
+    e32(j, imm);
+}
+
+/* group 1 arithmetic with immediate: 0 add, 1 or, 4 and, 5 sub, 6 xor */
+static void aluImm(Jit *j, int digit, int reg, uint32_t imm)
+{
+    opRR(j, 0, 0x81, digit, reg);
+    e32(j, imm);
+}
+
+/* shifts by immediate: 4 shl, 5 shr */
+static void shiftImm(Jit *j, int digit, int reg, uint8_t n)
+{
+    opRR(j, 0, 0xc1, digit, reg);
+    e8(j, n);
+}
+
+static void movzx8(Jit *j, int dst, int src)
+{
+    opRR(j, 0, 0x0fb6, dst, src);
+}
+
+static void jmpTo(Jit *j, const uint8_t *target)
+{
+    e8(j, 0xe9);
+    e32(j, (uint32_t)(target - (j->buf + j->used + 4)));
+}
+
+static void jccTo(Jit *j, enum cc cc, const uint8_t *target)
+{
+    e8(j, 0x0f);
+    e8(j, 0x80 | cc);
+    e32(j, (uint32_t)(target - (j->buf + j->used + 4)));
+}
+
+static void stub(Jit *j, uint8_t *field, enum exitreason reason, uint16_t pc,
+        int areg, int32_t adisp)
+{
+    Stub *s = j->stubs + j->nstubs++;
+    s->field = field;
+    s->reason = reason;
+    s->pc = pc;
+    s->areg = areg;
+    s->adisp = adisp;
+}
+
+static void jmpStub(Jit *j, enum exitreason reason, uint16_t pc)
+{
+    e8(j, 0xe9);
+    stub(j, j->buf + j->used, reason, pc, -1, 0);
+    e32(j, 0);
+}
+
+static void jccStub(Jit *j, enum cc cc, enum exitreason reason, uint16_t pc,
+        int areg, int32_t adisp)
+{
+    e8(j, 0x0f);
+    e8(j, 0x80 | cc);
+    stub(j, j->buf + j->used, reason, pc, areg, adisp);
+    e32(j, 0);
+}
+
+static void nz(Jit *j, int r)
+{
+    mov(j, RZ, r);
+    mov(j, RN, r);
+}
+
+static void emitFixed(Jit *j)
+{
+    static const uint8_t pushes[] = {
+        0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
+        0x48, 0x83, 0xec, 0x08
+    };
+    static const uint8_t pops[] = {
+        0x48, 0x83, 0xc4, 0x08,
+        0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3
+    };
+    const int32_t a = offsetof(Cpu, regs) + CR_A;
+    const int32_t x = offsetof(Cpu, regs) + CR_X;
+    const int32_t y = offsetof(Cpu, regs) + CR_Y;
+    const int32_t zres = offsetof(Cpu, flags) + offsetof(LazyFlags, zres);
+    const int32_t nres = offsetof(Cpu, flags) + offsetof(LazyFlags, nres);
+    const int32_t carry = offsetof(Cpu, flags) + offsetof(LazyFlags, carry);
+
+    /* int enter(Jit *jit, Cpu *cpu, uint8_t *ram, const uint8_t *code) */
+    j->enter = (JitEntry)(void *)(j->buf + j->used);
+    memcpy(j->buf + j->used, pushes, sizeof pushes);
+    j->used += sizeof pushes;
+    opRR(j, 1, 0x89, RDI, RJIT);
+    opRR(j, 1, 0x89, RSI, RCPU);
+    opRR(j, 1, 0x89, RDX, RMEM);
+    opRM(j, 0, 0x0fb6, RA, mem(RCPU, -1, a));
+    opRM(j, 0, 0x0fb6, RX, mem(RCPU, -1, x));
+    opRM(j, 0, 0x0fb6, RY, mem(RCPU, -1, y));
+    opRM(j, 0, 0x0fb7, RS, mem(RCPU, -1, offsetof(Cpu, sp)));
+    opRM(j, 0, 0x0fb6, RZ, mem(RCPU, -1, zres));
+    opRM(j, 0, 0x0fb6, RN, mem(RCPU, -1, nres));
+    opRM(j, 0, 0x0fb6, RC, mem(RCPU, -1, carry));
+    opRR(j, 0, 0xff, 4, RCX);
+
+    /* entered with reason in eax, pc in edx, argument in rcx */
+    j->epilogue = j->buf + j->used;
+    opRM(j, 0, 0x88, RA, mem(RCPU, -1, a));
+    opRM(j, 0, 0x88, RX, mem(RCPU, -1, x));
+    opRM(j, 0, 0x88, RY, mem(RCPU, -1, y));
+    e8(j, 0x66);
+    opRM(j, 0, 0x89, RS, mem(RCPU, -1, offsetof(Cpu, sp)));
+    e8(j, 0x66);
+    opRM(j, 0, 0x89, RDX, mem(RCPU, -1, offsetof(Cpu, pc)));
+    opRM(j, 0, 0x88, RZ, mem(RCPU, -1, zres));
+    opRM(j, 0, 0x88, RN, mem(RCPU, -1, nres));
+    opRM(j, 0, 0x88, RC, mem(RCPU, -1, carry));
+    opRM(j, 1, 0x89, RCX, mem(RJIT, -1, offsetof(Jit, exitArg)));
+    memcpy(j->buf + j->used, pops, sizeof pops);
+    j->used += sizeof pops;
+
+    /* RTS target not compiled, pc in edx */
+    j->lookup = j->buf + j->used;
+    movImm(j, RAX, EXIT_LOOKUP);
+    jmpTo(j, j->epilogue);
+
+    j->base = j->used;
+}
+
+static void markDevices(Jit *self)
+{
+    const Ram *ram = self->cpu->ram;
+    for (unsigned i = 0; i < ram->ndevices; ++i)
+    {
+        memset(self->codemap + ram->device[i].at, 1, ram->device[i].size);
+    }
+}
+
+static void flush(Jit *self)
+{
+    memset(self->entry, 0, sizeof self->entry);
+    memset(self->codemap, 0, sizeof self->codemap);
+    markDevices(self);
+    Ram_clearCode(self->cpu->ram);
+    self->nblocks = 0;
+    self->nlinks = 0;
+    self->used = self->base;
+    ++self->generation;
+}
+
+/* effective address of a multimode instruction as a memory operand,
+ * emitting code to calculate it where necessary */
+static Mem operand(Jit *j, uint8_t op, uint16_t pc)
+{
+    const uint8_t *m = j->ram;
+    uint16_t arg = m[pc + 1];
+    int idx = RX;
+
+    switch (op & 7)
+    {
+        case O_AM_IMMEDIATE:
+            return mem(RMEM, -1, pc + 1);
+        case O_AM_ABSOLUTE:
+            return mem(RMEM, -1, arg | m[pc + 2] << 8);
+        case O_AM_ZP_ABS:
+            return mem(RMEM, -1, arg);
+        case O_AM_ZP_IDX_Y:
+            idx = RY;
+            /* fall through */
+        case O_AM_ZP_IDX_X:
+            return mem(RMEM, idx, arg);
+        case O_AM_IDX_Y:
+            idx = RY;
+            /* fall through */
+        case O_AM_IDX_X:
+            arg |= m[pc + 2] << 8;
+            if (arg <= 0xff00) return mem(RMEM, idx, arg);
+            opRM(j, 0, 0x8d, RDX, mem(idx, -1, arg));
+            opRR(j, 0, 0x0fb7, RDX, RDX);
+            return mem(RMEM, RDX, 0);
+        default:
+            opRM(j, 0, 0x0fb7, RDX, mem(RMEM, -1, arg));
+            opRR(j, 0, 0x01, RY, RDX);
+            opRR(j, 0, 0x0fb7, RDX, RDX);
+            return mem(RMEM, RDX, 0);
+    }
+}
+
+static void load(Jit *j, int dst, uint8_t op, uint16_t pc, Mem m)
+{
+    if ((op & 7) == O_AM_IMMEDIATE) movImm(j, dst, j->ram[pc + 1]);
+    else opRM(j, 0, 0x0fb6, dst, m);
+}
+
+static void store(Jit *j, int src, Mem m, uint16_t next)
+{
+    opRM(j, 0, 0x88, src, m);
+    m.base = RJIT;
+    m.disp += offsetof(Jit, codemap);
+    opRM(j, 0, 0x80, 7, m);
+    e8(j, 0);
+    jccStub(j, CC_NZ, EXIT_SMC, next, m.index, m.disp - offsetof(Jit, codemap));
+}
+
+static void shiftOp(Jit *j, uint8_t op)
+{
+    switch (op)
+    {
+        case O_LSR:
+            mov(j, RC, RAX);
+            aluImm(j, 4, RC, 1);
+            shiftImm(j, 5, RAX, 1);
+            break;
+        case O_ASL:
+            mov(j, RC, RAX);
+            shiftImm(j, 5, RC, 7);
+            opRR(j, 0, 0x01, RAX, RAX);
+            movzx8(j, RAX, RAX);
+            break;
+        case O_ROR:
+            mov(j, RCX, RC);
+            shiftImm(j, 4, RCX, 7);
+            mov(j, RC, RAX);
+            aluImm(j, 4, RC, 1);
+            shiftImm(j, 5, RAX, 1);
+            opRR(j, 0, 0x09, RCX, RAX);
+            break;
+        case O_ROL:
+            mov(j, RCX, RC);
+            mov(j, RC, RAX);
+            shiftImm(j, 5, RC, 7);
+            opRR(j, 0, 0x01, RAX, RAX);
+            opRR(j, 0, 0x09, RCX, RAX);
+            movzx8(j, RAX, RAX);
+            break;
+    }
+}
+
+static void compare(Jit *j, int r)
+{
+    mov(j, RAX, r);
+    opRR(j, 0, 0x29, RCX, RAX);
+    movzx8(j, RAX, RAX);
+    opRR(j, 0, 0x31, RC, RC);
+    opRR(j, 0, 0x39, r, RAX);
+    opRR(j, 0, 0x0f92, 0, RC);
+    nz(j, RAX);
+}
+
+static void multimode(Jit *j, uint8_t op, uint16_t pc, uint16_t next)
+{
+    Mem m = operand(j, op, pc);
+    switch (op & 0xf8)
+    {
+        case O_LDA: load(j, RA, op, pc, m); nz(j, RA); break;
+        case O_LDX: load(j, RX, op, pc, m); nz(j, RX); break;
+        case O_LDY: load(j, RY, op, pc, m); nz(j, RY); break;
+        case O_STA: store(j, RA, m, next); break;
+        case O_STX: store(j, RX, m, next); break;
+        case O_STY: store(j, RY, m, next); break;
+        case O_AND:
+            load(j, RCX, op, pc, m);
+            opRR(j, 0, 0x21, RCX, RA);
+            nz(j, RA);
+            break;
+        case O_ORA:
+            load(j, RCX, op, pc, m);
+            opRR(j, 0, 0x09, RCX, RA);
+            nz(j, RA);
+            break;
+        case O_EOR:
+            load(j, RCX, op, pc, m);
+            opRR(j, 0, 0x31, RCX, RA);
+            nz(j, RA);
+            break;
+        case O_LSR:
+        case O_ASL:
+        case O_ROR:
+        case O_ROL:
+            opRM(j, 0, 0x0fb6, RAX, m);
+            shiftOp(j, op & 0xf8);
+            nz(j, RAX);
+            store(j, RAX, m, next);
+            break;
+        case O_ADC:
+            load(j, RCX, op, pc, m);
+            opRR(j, 0, 0x01, RCX, RA);
+            opRR(j, 0, 0x01, RC, RA);
+            mov(j, RC, RA);
+            shiftImm(j, 5, RC, 8);
+            movzx8(j, RA, RA);
+            nz(j, RA);
+            break;
+        case O_SBC:
+            load(j, RCX, op, pc, m);
+            /* a -= v; carry = a <= v */
+            opRR(j, 0, 0x29, RCX, RA);
+            movzx8(j, RA, RA);
+            opRR(j, 0, 0x31, RDX, RDX);
+            opRR(j, 0, 0x39, RCX, RA);
+            opRR(j, 0, 0x0f96, 0, RDX);
+            /* without carry in: carry &= a != 0; --a */
+            opRR(j, 0, 0x31, RSI, RSI);
+            opRR(j, 0, 0x85, RA, RA);
+            opRR(j, 0, 0x0f95, 0, RSI);
+            opRR(j, 0, 0x09, RC, RSI);
+            opRR(j, 0, 0x21, RSI, RDX);
+            mov(j, RSI, RC);
+            aluImm(j, 6, RSI, 1);
+            opRR(j, 0, 0x29, RSI, RA);
+            movzx8(j, RA, RA);
+            mov(j, RC, RDX);
+            nz(j, RA);
+            break;
+        case O_INC:
+        case O_DEC:
+            opRM(j, 0, 0x0fb6, RAX, m);
+            opRR(j, 0, 0xfe, op >= O_DEC, RAX);
+            movzx8(j, RAX, RAX);
+            nz(j, RAX);
+            store(j, RAX, m, next);
+            break;
+        case O_CMP: load(j, RCX, op, pc, m); compare(j, RA); break;
+        case O_CPX: load(j, RCX, op, pc, m); compare(j, RX); break;
+        case O_CPY: load(j, RCX, op, pc, m); compare(j, RY); break;
+    }
+}
+
+static void push(Jit *j, int r, uint16_t pc)
+{
+    aluImm(j, 7, RS, 256);
+    jccStub(j, CC_Z, EXIT_INTERP, pc, -1, 0);
+    opRM(j, 0, 0x88, r, mem(RCPU, RS, offsetof(Cpu, stack)));
+    aluImm(j, 0, RS, 1);
+}
+
+static void pull(Jit *j, int r, uint16_t pc)
+{
+    opRR(j, 0, 0x85, RS, RS);
+    jccStub(j, CC_Z, EXIT_INTERP, pc, -1, 0);
+    aluImm(j, 5, RS, 1);
+    opRM(j, 0, 0x0fb6, r, mem(RCPU, RS, offsetof(Cpu, stack)));
+}
+
+static void implicit(Jit *j, uint8_t op, uint16_t pc)
+{
+    switch (op)
+    {
+        case O_RTS:
+            aluImm(j, 7, RS, 2);
+            jccStub(j, CC_B, EXIT_INTERP, pc, -1, 0);
+            opRM(j, 0, 0x0fb6, RDX,
+                    mem(RCPU, RS, offsetof(Cpu, stack) - 1));
+            shiftImm(j, 4, RDX, 8);
+            opRM(j, 0, 0x0fb6, RAX,
+                    mem(RCPU, RS, offsetof(Cpu, stack) - 2));
+            opRR(j, 0, 0x09, RAX, RDX);
+            aluImm(j, 5, RS, 2);
+            opRM(j, 1, 0x8b, RAX,
+                    (Mem){ RJIT, RDX, 3, offsetof(Jit, entry) });
+            opRR(j, 1, 0x85, RAX, RAX);
+            jccTo(j, CC_Z, j->lookup);
+            opRR(j, 0, 0xff, 4, RAX);
+            break;
+        case O_SRA:
+        case O_SLA:
+        case O_RRA:
+        case O_RLA:
+            mov(j, RAX, RA);
+            shiftOp(j, O_LSR + ((op - O_SRA) << 3));
+            mov(j, RA, RAX);
+            nz(j, RA);
+            break;
+        case O_INA: opRR(j, 0, 0xfe, 0, RA); nz(j, RA); break;
+        case O_DEA: opRR(j, 0, 0xfe, 1, RA); nz(j, RA); break;
+        case O_INX: opRR(j, 0, 0xfe, 0, RX); nz(j, RX); break;
+        case O_DEX: opRR(j, 0, 0xfe, 1, RX); nz(j, RX); break;
+        case O_INY: opRR(j, 0, 0xfe, 0, RY); nz(j, RY); break;
+        case O_DEY: opRR(j, 0, 0xfe, 1, RY); nz(j, RY); break;
+        case O_SEZ: movImm(j, RZ, 0); break;
+        case O_CLZ: movImm(j, RZ, 1); break;
+        case O_SEN: movImm(j, RN, 0x80); break;
+        case O_CLN: movImm(j, RN, 0); break;
+        case O_SEC: movImm(j, RC, 1); break;
+        case O_CLC: movImm(j, RC, 0); break;
+        case O_TAX: mov(j, RX, RA); nz(j, RX); break;
+        case O_TXA: mov(j, RA, RX); nz(j, RA); break;
+        case O_TAY: mov(j, RY, RA); nz(j, RY); break;
+        case O_TYA: mov(j, RA, RY); nz(j, RA); break;
+        case O_TXY: mov(j, RY, RX); nz(j, RY); break;
+        case O_TYX: mov(j, RX, RY); nz(j, RX); break;
+        case O_PHA: push(j, RA, pc); break;
+        case O_PLA: pull(j, RA, pc); break;
+        case O_PHX: push(j, RX, pc); break;
+        case O_PLX: pull(j, RX, pc); break;
+        case O_PHY: push(j, RY, pc); break;
+        case O_PLY: pull(j, RY, pc); break;
+    }
+}
+
+static void branch(Jit *j, uint8_t op, uint16_t pc, uint16_t next,
+        uint16_t target)
+{
+    enum cc cc;
+    switch (op & 0xfe)
+    {
+        case O_BSR:
+            aluImm(j, 7, RS, 255);
+            jccStub(j, CC_AE, EXIT_INTERP, pc, -1, 0);
+            opRM(j, 0, 0xc6, 0, mem(RCPU, RS, offsetof(Cpu, stack)));
+            e8(j, next & 0xff);
+            opRM(j, 0, 0xc6, 0, mem(RCPU, RS, offsetof(Cpu, stack) + 1));
+            e8(j, next >> 8);
+            aluImm(j, 0, RS, 2);
+            /* fall through */
+        case O_BRA:
+            jmpStub(j, EXIT_LINK, target);
+            return;
+        case O_BNE:
+        case O_BEQ:
+            opRR(j, 0, 0x84, RZ, RZ);
+            cc = (op & 0xfe) == O_BNE ? CC_NZ : CC_Z;
+            break;
+        case O_BPL:
+        case O_BMI:
+            opRR(j, 0, 0xf6, 0, RN);
+            e8(j, 0x80);
+            cc = (op & 0xfe) == O_BMI ? CC_NZ : CC_Z;
+            break;
+        default:
+            opRR(j, 0, 0x85, RC, RC);
+            cc = (op & 0xfe) == O_BCS ? CC_NZ : CC_Z;
+            break;
+    }
+    jccStub(j, cc, EXIT_LINK, target, -1, 0);
+    jmpStub(j, EXIT_LINK, next);
+}
+
+/* length of an instruction the compiler handles, 0 for anything else */
+static unsigned length(uint8_t op)
+{
+    if ((op & O_AM_IMPLICIT) != O_AM_IMPLICIT)
+    {
+        if (op >= O_WUD) return 0;
+        switch (op & 7)
+        {
+            case O_AM_ABSOLUTE:
+            case O_AM_IDX_X:
+            case O_AM_IDX_Y:
+                return 3;
+            default:
+                return 2;
+        }
+    }
+    if ((op & O_AM_JUMP) == O_AM_JUMP) return (op & O_AM_ABSOLUTE) ? 3 : 2;
+    if (op >= O_RTS && op <= O_PLY) return 1;
+    return 0;
+}
+
+static void emitStubs(Jit *j)
+{
+    for (size_t i = 0; i < j->nstubs; ++i)
+    {
+        Stub *s = j->stubs + i;
+        uint32_t rel = (uint32_t)(j->buf + j->used - (s->field + 4));
+        memcpy(s->field, &rel, 4);
+        if (s->reason == EXIT_SMC)
+        {
+            if (s->areg < 0) movImm(j, RCX, s->adisp);
+            else opRM(j, 0, 0x8d, RCX, mem(s->areg, -1, s->adisp));
+        }
+        if (s->reason == EXIT_LINK)
+        {
+            e8(j, 0x48);
+            e8(j, 0xb9);
+            e64(j, (uintptr_t)s->field);
+        }
+        movImm(j, RDX, s->pc);
+        movImm(j, RAX, s->reason);
+        jmpTo(j, j->epilogue);
+    }
+    j->nstubs = 0;
+}
+
+static uint8_t *translate(Jit *self, uint16_t start)
+{
+    const uint8_t *m = self->ram;
+    uint32_t pc = start;
+    unsigned n = 0;
+
+    if (self->hot[start]) return 0;
+    if (CODESIZE - self->used < MAXBLOCKCODE) flush(self);
+    uint8_t *code = self->buf + self->used;
+
+    for (;;)
+    {
+        /* the last instruction ended at $ffff, execution wraps around */
+        if (pc >= RAM_MAXSIZE)
+        {
+            jmpStub(self, EXIT_LINK, pc & 0xffff);
+            break;
+        }
+        uint8_t op = m[pc];
+        unsigned len = length(op);
+        int target = 0;
+        if (len && pc + len > RAM_MAXSIZE) len = 0;
+        if (len && (op & O_AM_JUMP) == O_AM_JUMP)
+        {
+            if (op & O_AM_ABSOLUTE)
+            {
+                target = m[pc + 1] | m[pc + 2] << 8;
+            }
+            else
+            {
+                target = (uint16_t)(pc + 2) + (int8_t)m[pc + 1];
+                if (target < 0) len = 0;
+            }
+        }
+        if (!len || n == MAXINSNS)
+        {
+            if (!n) return 0;
+            jmpStub(self, EXIT_LINK, pc);
+            break;
+        }
+        uint16_t next = pc + len;
+        ++n;
+        if ((op & O_AM_IMPLICIT) != O_AM_IMPLICIT)
+        {
+            multimode(self, op, pc, next);
+        }
+        else if ((op & O_AM_JUMP) == O_AM_JUMP)
+        {
+            branch(self, op, pc, next, target);
+            pc += len;
+            break;
+        }
+        else
+        {
+            implicit(self, op, pc);
+            if (op == O_RTS)
+            {
+                pc += len;
+                break;
+            }
+        }
+        pc += len;
+    }
+    emitStubs(self);
+
+    if (self->nblocks == self->blockscapa)
+    {
+        size_t nc = self->blockscapa ? 2 * self->blockscapa : 64;
+        Block *nb = realloc(self->blocks, nc * sizeof *nb);
+        if (!nb)
+        {
+            self->used = code - self->buf;
+            return 0;
+        }
+        self->blocks = nb;
+        self->blockscapa = nc;
+    }
+    Block *b = self->blocks + self->nblocks++;
+    b->code = code;
+    b->start = start;
+    b->end = pc;
+    memset(self->codemap + start, 1, pc - start);
+    Ram_markCode(self->cpu->ram, start, pc - start);
+    self->entry[start] = code;
+    return code;
+}
+
+static void link(Jit *self, uint8_t *field, uint16_t target, uint8_t *code)
+{
+    if (self->nlinks == self->linkscapa)
+    {
+        size_t nc = self->linkscapa ? 2 * self->linkscapa : 64;
+        Link *nl = realloc(self->links, nc * sizeof *nl);
+        if (!nl) return;
+        self->links = nl;
+        self->linkscapa = nc;
+    }
+    Link *l = self->links + self->nlinks++;
+    int32_t rel;
+    memcpy(&rel, field, 4);
+    l->field = field;
+    l->stub = field + 4 + rel;
+    l->target = target;
+    rel = code - (field + 4);
+    memcpy(field, &rel, 4);
+}
+
+static void invalidate(Jit *self, uint16_t at, size_t size)
+{
+    int found = 0;
+    for (size_t i = 0; i < self->nblocks;)
+    {
+        Block *b = self->blocks + i;
+        if (b->start >= at + size || b->end <= at)
+        {
+            ++i;
+            continue;
+        }
+        found = 1;
+        self->entry[b->start] = 0;
+        if (++self->smccount[b->start] == HOTLIMIT) self->hot[b->start] = 1;
+        for (size_t l = 0; l < self->nlinks;)
+        {
+            Link *k = self->links + l;
+            if (k->target != b->start)
+            {
+                ++l;
+                continue;
+            }
+            int32_t rel = k->stub - (k->field + 4);
+            memcpy(k->field, &rel, 4);
+            *k = self->links[--self->nlinks];
+        }
+        *b = self->blocks[--self->nblocks];
+    }
+    if (!found) return;
+    memset(self->codemap, 0, sizeof self->codemap);
+    for (size_t i = 0; i < self->nblocks; ++i)
+    {
+        Block *b = self->blocks + i;
+        memset(self->codemap + b->start, 1, b->end - b->start);
+    }
+    markDevices(self);
+}
+
+static void written(void *ctx, uint16_t at, size_t size)
+{
+    Jit *self = ctx;
+    if (size > 1 || self->codemap[at]) invalidate(self, at, size);
+}
+
+Jit *Jit_create(Cpu *cpu)
+{
+    if (Ram_size(cpu->ram) != RAM_MAXSIZE) return 0;
+    uint8_t *ram = Ram_data(cpu->ram);
+    if (!ram) return 0;
+    Jit *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    self->buf = mmap(0, CODESIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (self->buf == MAP_FAILED)
+    {
+        free(self);
+        return 0;
+    }
+    self->cpu = cpu;
+    self->ram = ram;
+    Ram_watchCode(cpu->ram, written, self);
+    markDevices(self);
+    emitFixed(self);
+    return self;
+}
+
+int Jit_run(Jit *self)
+{
+    Cpu *cpu = self->cpu;
+    uint8_t *code = 0;
+
+    for (;;)
+    {
+        uint16_t pc = cpu->pc;
+        if (!code)
+        {
+            code = self->entry[pc];
+            if (!code) code = translate(self, pc);
+        }
+        if (!code)
+        {
+            if (Cpu_step(cpu, 0) < 0) return -1;
+            continue;
+        }
+
+        int reason = self->enter(self, cpu, self->ram, code);
+        code = 0;
+        pc = cpu->pc;
+        switch (reason)
+        {
+            case EXIT_LINK:
+                if (self->hot[pc]) break;
+                unsigned generation = self->generation;
+                code = self->entry[pc];
+                if (!code) code = translate(self, pc);
+                if (code && generation == self->generation)
+                {
+                    link(self, (uint8_t *)self->exitArg, pc, code);
+                }
+                break;
+
+            case EXIT_INTERP:
+                if (Cpu_step(cpu, 0) < 0) return -1;
+                break;
+
+            case EXIT_SMC:
+                Ram_written(cpu->ram, self->exitArg, 1);
+                break;
+        }
+    }
+}
+
+void Jit_destroy(Jit *self)
+{
+    if (!self) return;
+    Ram_watchCode(self->cpu->ram, 0, 0);
+    munmap(self->buf, CODESIZE);
+    free(self->blocks);
+    free(self->links);
+    free(self);
+}
+
+#else
+
+Jit *Jit_create(Cpu *cpu)
+{
+    return 0;
+}
+
+int Jit_run(Jit *self)
+{
+    return -1;
+}
+
+void Jit_destroy(Jit *self)
+{
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef JIT_H
+#define JIT_H
+
+typedef struct Cpu Cpu;
+typedef struct Jit Jit;
+
+Jit *Jit_create(Cpu *cpu);
+int Jit_run(Jit *self);
+void Jit_destroy(Jit *self);
+
+#endif
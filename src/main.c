@@ -5,6 +5,7 @@
 #include "help.h"
 #include "vm.h"
 #include "asm.h"
+#include "aot.h"
 
 int main(int argc, char **argv)
 {
@@ -22,6 +23,11 @@ int main(int argc, char **argv)
         return asmain(--argc, ++argv);
     }
 
+    if (argc > 1 && !strcmp(argv[1], "aot"))
+    {
+        return aotmain(--argc, ++argv);
+    }
+
     if (strlen(argv[0]) > 4)
     {
         char *cmdname = strrchr(argv[0], '/');
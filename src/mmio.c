@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mmio.h"
+#include "ram.h"
+#include "output.h"
+
+/* Device registers, relative to the base address:
+ *
+ *   0      output: a byte written here is written to the output
+ *   1      commit: writing n writes n bytes (0 means 256) from the buffer
+ *   2      clock: any write latches the milliseconds since the devices
+ *          were created to the clock value
+ *   4-7    clock value, 32bit little endian
+ *   $100   buffer, 256 bytes
+ */
+
+#define MMIO_OUT 0
+#define MMIO_COMMIT 1
+#define MMIO_CLOCK 2
+#define MMIO_CLOCKVAL 4
+#define MMIO_BUFFER 0x100
+
+struct Mmio
+{
+    Ram *ram;
+    Output *out;
+    uint16_t base;
+    int interactive;
+    struct timespec start;
+};
+
+static uint32_t millis(const Mmio *self)
+{
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (now.tv_sec - self->start.tv_sec) * 1000
+        + (now.tv_nsec - self->start.tv_nsec) / 1000000;
+}
+
+static void store(void *ctx, uint16_t at, uint8_t byte)
+{
+    Mmio *self = ctx;
+    uint8_t buf[256];
+    unsigned size;
+    uint32_t ms;
+
+    switch (at - self->base)
+    {
+        case MMIO_OUT:
+            Output_putc(self->out, byte);
+            if (self->interactive) Output_flush(self->out);
+            else Output_checkInterval(self->out);
+            break;
+        case MMIO_COMMIT:
+            size = byte ? byte : 256;
+            for (unsigned i = 0; i < size; ++i)
+            {
+                buf[i] = Ram_get(self->ram, self->base + MMIO_BUFFER + i);
+            }
+            Output_write(self->out, buf, size);
+            if (self->interactive) Output_flush(self->out);
+            else Output_checkInterval(self->out);
+            break;
+        case MMIO_CLOCK:
+            ms = millis(self);
+            for (int i = 0; i < 4; ++i)
+            {
+                Ram_set(self->ram, self->base + MMIO_CLOCKVAL + i,
+                        ms >> (8 * i));
+            }
+            break;
+    }
+}
+
+Mmio *Mmio_create(Ram *ram, uint16_t base, Output *out, int interactive)
+{
+    if ((size_t)base + MMIO_BUFFER + 256 > Ram_size(ram)) return 0;
+    Mmio *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    self->ram = ram;
+    self->out = out;
+    self->base = base;
+    self->interactive = interactive;
+    timespec_get(&self->start, TIME_UTC);
+    if (Ram_mapDevice(ram, base, MMIO_CLOCK + 1, store, self) < 0)
+    {
+        free(self);
+        return 0;
+    }
+    return self;
+}
+
+void Mmio_destroy(Mmio *self)
+{
+    if (!self) return;
+    Ram_unmapDevices(self->ram, self);
+    free(self);
+}
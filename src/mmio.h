@@ -0,0 +1,13 @@
+#ifndef MMIO_H
+#define MMIO_H
+
+#include <stdint.h>
+
+typedef struct Ram Ram;
+typedef struct Output Output;
+typedef struct Mmio Mmio;
+
+Mmio *Mmio_create(Ram *ram, uint16_t base, Output *out, int interactive);
+void Mmio_destroy(Mmio *self);
+
+#endif
@@ -4,83 +4,25 @@
 
 #include "opcode.h"
 
-static const char *multimode[] =
-{
-    "LDA",
-    "STA",
-    "LDX",
-    "STX",
-    "LDY",
-    "STY",
-    "AND",
-    "ORA",
-    "EOR",
-    "LSR",
-    "ASL",
-    "ROR",
-    "ROL",
-    "ADC",
-    "SBC",
-    "INC",
-    "DEC",
-    "CMP",
-    "CPX",
-    "CPY",
-    "WUD",
-    "WSD",
-    "WCH",
-    "WTX"
-};
+#define MODE_INFO(n, v, m, size) \
+    [(v) | O_AM_##m] = { #n, OC_MULTIMODE, O_AM_##m, size },
 
-static const char *implicit[] =
-{
-    "HLT",
-    "RTS",
-    "SRA",
-    "SLA",
-    "RRA",
-    "RLA",
-    "INA",
-    "DEA",
-    "INX",
-    "DEX",
-    "INY",
-    "DEY",
-    "SEZ",
-    "CLZ",
-    "SEN",
-    "CLN",
-    "SEC",
-    "CLC",
-    "TAX",
-    "TXA",
-    "TAY",
-    "TYA",
-    "TXY",
-    "TYX",
-    "PHA",
-    "PLA",
-    "PHX",
-    "PLX",
-    "WNL",
-    "WTB",
-    "WSP",
-    "RUD",
-    "RSD",
-    "RCH",
-    "RTX"
-};
+#define MM_INFO(n, v) ISA_MODES(MODE_INFO, n, v)
+
+#define IMP_SIZE(v) ((v) == O_RTX || (v) == O_RBK || (v) == O_WBK ? 2 : 1)
+
+#define IMP_INFO(n, v) \
+    [v] = { #n, OC_IMPLICIT, O_AM_IMPLICIT, IMP_SIZE(v) },
 
-static const char *branch[] =
+#define BR_INFO(n, v) \
+    [(v) | O_AM_RELATIVE] = { #n, OC_BRANCH, O_AM_RELATIVE, 2 }, \
+    [(v) | O_AM_ABSOLUTE] = { #n, OC_BRANCH, O_AM_ABSOLUTE, 3 },
+
+static const OpcodeInfo info[256] =
 {
-    "BSR",
-    "BRA",
-    "BNE",
-    "BEQ",
-    "BPL",
-    "BMI",
-    "BCC",
-    "BCS"
+    ISA_MULTIMODE(MM_INFO)
+    ISA_IMPLICIT(IMP_INFO)
+    ISA_BRANCH(BR_INFO)
 };
 
 static void uc(char *upper, size_t n, const char *str)
@@ -102,47 +44,26 @@ int Opcode_fromString(Opcode *oc, const char *str, Opcode am)
     uc(opstr, 4, str);
 
     int found = 0;
-    uint8_t i;
-    if (*opstr == 'B')
-    {
-	for (i = 0; i < sizeof branch / sizeof *branch; ++i)
-	{
-	    if (!strcmp(opstr, branch[i]))
-	    {
-		found = 1;
-		break;
-	    }
-	}
-	if (!found) return ILL_INST;
-	if (am < O_AM_RELATIVE || am > O_AM_ABSOLUTE) return ILL_AM;
-	*oc = O_AM_JUMP | i<<1 | am;
-	return 0;
-    }
-    for (i = 0; i < sizeof multimode / sizeof *multimode; ++i)
+    for (int i = 0; i < 256; ++i)
     {
-	if (!strcmp(opstr, multimode[i]))
+	if (!info[i].name || strcmp(opstr, info[i].name)) continue;
+	found = 1;
+	if (info[i].cls == OC_IMPLICIT ?
+		am == O_AM_IMPLICIT : am == info[i].mode)
 	{
-	    found = 1;
-	    break;
+	    *oc = i;
+	    return 0;
 	}
     }
-    if (found)
-    {
-	if (am < O_AM_IMMEDIATE || am > O_AM_ZP_IND_Y) return ILL_AM;
-	*oc = i<<3 | am;
-	return 0;
-    }
-    for (i = 0; i < sizeof implicit / sizeof *implicit; ++i)
-    {
-	if (!strcmp(opstr, implicit[i]))
-	{
-	    found = 1;
-	    break;
-	}
-    }
-    if (!found) return ILL_INST;
-    if (am != O_AM_IMPLICIT) return ILL_AM;
-    *oc = i | am;
-    return 0;
+    return found ? ILL_AM : ILL_INST;
 }
 
+const OpcodeInfo *Opcode_info(uint8_t oc)
+{
+    return info + oc;
+}
+
+const char *Opcode_name(uint8_t oc)
+{
+    return info[oc].name ? info[oc].name : "ILL";
+}
@@ -1,6 +1,111 @@
 #ifndef OPCODE_H
 #define OPCODE_H
 
+#include <stdint.h>
+
+/* The instruction set. Multimode instructions are combined with one of the
+ * addressing modes in the low 3 bits, branches with O_AM_RELATIVE or
+ * O_AM_ABSOLUTE in the lowest bit. Implicit instructions take no operand,
+ * except for RTX, RBK and WBK, which take the high byte of their buffer
+ * address.
+ *
+ * RBK reads up to X bytes (0 means 256) of input into the buffer, like a
+ * single read(), and sets X to the number of bytes read. If the input
+ * ended, nothing is read and the carry is set, otherwise it is cleared.
+ * WBK writes X bytes (0 means 256) from the buffer to the output.
+ */
+
+#define ISA_MULTIMODE(X) \
+    X(LDA, 0 << 3) \
+    X(STA, 1 << 3) \
+    X(LDX, 2 << 3) \
+    X(STX, 3 << 3) \
+    X(LDY, 4 << 3) \
+    X(STY, 5 << 3) \
+    X(AND, 6 << 3) \
+    X(ORA, 7 << 3) \
+    X(EOR, 8 << 3) \
+    X(LSR, 9 << 3) \
+    X(ASL, 10 << 3) \
+    X(ROR, 11 << 3) \
+    X(ROL, 12 << 3) \
+    X(ADC, 13 << 3) \
+    X(SBC, 14 << 3) \
+    X(INC, 15 << 3) \
+    X(DEC, 16 << 3) \
+    X(CMP, 17 << 3) \
+    X(CPX, 18 << 3) \
+    X(CPY, 19 << 3) \
+    X(WUD, 20 << 3) \
+    X(WSD, 21 << 3) \
+    X(WCH, 22 << 3) \
+    X(WTX, 23 << 3)
+
+#define ISA_IMPLICIT(X) \
+    X(HLT, 0xc0) \
+    X(RTS, 0xc1) \
+    X(SRA, 0xc2) \
+    X(SLA, 0xc3) \
+    X(RRA, 0xc4) \
+    X(RLA, 0xc5) \
+    X(INA, 0xc6) \
+    X(DEA, 0xc7) \
+    X(INX, 0xc8) \
+    X(DEX, 0xc9) \
+    X(INY, 0xca) \
+    X(DEY, 0xcb) \
+    X(SEZ, 0xcc) \
+    X(CLZ, 0xcd) \
+    X(SEN, 0xce) \
+    X(CLN, 0xcf) \
+    X(SEC, 0xd0) \
+    X(CLC, 0xd1) \
+    X(TAX, 0xd2) \
+    X(TXA, 0xd3) \
+    X(TAY, 0xd4) \
+    X(TYA, 0xd5) \
+    X(TXY, 0xd6) \
+    X(TYX, 0xd7) \
+    X(PHA, 0xd8) \
+    X(PLA, 0xd9) \
+    X(PHX, 0xda) \
+    X(PLX, 0xdb) \
+    X(PHY, 0xdc) \
+    X(PLY, 0xdd) \
+    X(WNL, 0xde) \
+    X(WTB, 0xdf) \
+    X(WSP, 0xe0) \
+    X(RUD, 0xe1) \
+    X(RSD, 0xe2) \
+    X(RCH, 0xe3) \
+    X(RTX, 0xe4) \
+    X(RBK, 0xe5) \
+    X(WBK, 0xe6)
+
+#define ISA_BRANCH(X) \
+    X(BSR, 0x78 << 1) \
+    X(BRA, 0x79 << 1) \
+    X(BNE, 0x7a << 1) \
+    X(BEQ, 0x7b << 1) \
+    X(BPL, 0x7c << 1) \
+    X(BMI, 0x7d << 1) \
+    X(BCC, 0x7e << 1) \
+    X(BCS, 0x7f << 1)
+
+/* the addressing modes of a multimode instruction n with value v, and the
+ * size of the resulting instruction */
+#define ISA_MODES(X, n, v) \
+    X(n, v, IMMEDIATE, 2) \
+    X(n, v, ABSOLUTE, 3) \
+    X(n, v, ZP_ABS, 2) \
+    X(n, v, IDX_X, 3) \
+    X(n, v, ZP_IDX_X, 2) \
+    X(n, v, IDX_Y, 3) \
+    X(n, v, ZP_IDX_Y, 2) \
+    X(n, v, ZP_IND_Y, 2)
+
+#define O_ENUM(n, v) O_##n = (v),
+
 typedef enum Opcode
 {
     // Addressing modes
@@ -16,83 +121,34 @@ typedef enum Opcode
     O_AM_ZP_IDX_Y   = 6,
     O_AM_ZP_IND_Y   = 7,
 
-    O_LDA           = 0 << 3,
-    O_STA           = 1 << 3,
-    O_LDX           = 2 << 3,
-    O_STX           = 3 << 3,
-    O_LDY           = 4 << 3,
-    O_STY           = 5 << 3,
-    O_AND           = 6 << 3,
-    O_ORA           = 7 << 3,
-    O_EOR           = 8 << 3,
-    O_LSR           = 9 << 3,
-    O_ASL           = 10 << 3,
-    O_ROR           = 11 << 3,
-    O_ROL           = 12 << 3,
-    O_ADC           = 13 << 3,
-    O_SBC           = 14 << 3,
-    O_INC           = 15 << 3,
-    O_DEC           = 16 << 3,
-    O_CMP           = 17 << 3,
-    O_CPX           = 18 << 3,
-    O_CPY           = 19 << 3,
-    O_WUD           = 20 << 3,
-    O_WSD           = 21 << 3,
-    O_WCH           = 22 << 3,
-    O_WTX           = 23 << 3,
+    ISA_MULTIMODE(O_ENUM)
+    ISA_IMPLICIT(O_ENUM)
+    ISA_BRANCH(O_ENUM)
+} Opcode;
 
-    O_HLT           = 0xc0,
-    O_RTS           = 0xc1,
-    O_SRA           = 0xc2,
-    O_SLA           = 0xc3,
-    O_RRA           = 0xc4,
-    O_RLA           = 0xc5,
-    O_INA           = 0xc6,
-    O_DEA           = 0xc7,
-    O_INX           = 0xc8,
-    O_DEX           = 0xc9,
-    O_INY           = 0xca,
-    O_DEY           = 0xcb,
-    O_SEZ           = 0xcc,
-    O_CLZ           = 0xcd,
-    O_SEN           = 0xce,
-    O_CLN           = 0xcf,
-    O_SEC           = 0xd0,
-    O_CLC           = 0xd1,
-    O_TAX           = 0xd2,
-    O_TXA           = 0xd3,
-    O_TAY           = 0xd4,
-    O_TYA           = 0xd5,
-    O_TXY           = 0xd6,
-    O_TYX           = 0xd7,
-    O_PHA           = 0xd8,
-    O_PLA           = 0xd9,
-    O_PHX           = 0xda,
-    O_PLX           = 0xdb,
-    O_PHY           = 0xdc,
-    O_PLY           = 0xdd,
-    O_WNL           = 0xde,
-    O_WTB           = 0xdf,
-    O_WSP           = 0xe0,
-    O_RUD           = 0xe1,
-    O_RSD           = 0xe2,
-    O_RCH           = 0xe3,
-    O_RTX           = 0xe4,
+#undef O_ENUM
 
-    O_BSR           = 0x78 << 1,
-    O_BRA           = 0x79 << 1,
-    O_BNE           = 0x7a << 1,
-    O_BEQ           = 0x7b << 1,
-    O_BPL           = 0x7c << 1,
-    O_BMI           = 0x7d << 1,
-    O_BCC           = 0x7e << 1,
-    O_BCS           = 0x7f << 1
+typedef enum OpcodeClass
+{
+    OC_ILLEGAL,
+    OC_MULTIMODE,
+    OC_IMPLICIT,
+    OC_BRANCH
+} OpcodeClass;
 
-} Opcode;
+typedef struct OpcodeInfo
+{
+    const char *name;
+    uint8_t cls;
+    uint8_t mode;
+    uint8_t size;
+} OpcodeInfo;
 
 #define ILL_INST -1
 #define ILL_AM -2
 
 int Opcode_fromString(Opcode *oc, const char *str, Opcode am);
+const OpcodeInfo *Opcode_info(uint8_t oc);
+const char *Opcode_name(uint8_t oc);
 
 #endif
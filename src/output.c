@@ -0,0 +1,190 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+#include "output.h"
+
+typedef enum OutputSink
+{
+    OS_FILE,
+    OS_FD,
+    OS_MEMORY
+} OutputSink;
+
+/* A memory output grows its buffer as needed, an fd output writes it out
+ * when it's full. Everything written is copied to the tee first, if set.
+ */
+
+struct Output
+{
+    OutputSink sink;
+    FILE *file;
+    int fd;
+    size_t size;
+    size_t len;
+    uint8_t *buf;
+    Output *tee;
+    unsigned interval;
+    struct timespec flushed;
+};
+
+static Output *create(OutputSink sink, size_t size)
+{
+    Output *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    if (size && !(self->buf = malloc(size)))
+    {
+        free(self);
+        return 0;
+    }
+    self->sink = sink;
+    self->size = size;
+    return self;
+}
+
+static int writeAll(int fd, const uint8_t *data, size_t size)
+{
+    while (size)
+    {
+        long rc = write(fd, data, size);
+        if (rc < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += rc;
+        size -= rc;
+    }
+    return 0;
+}
+
+static int grow(Output *self, size_t size)
+{
+    size_t newsize = self->size ? self->size : 4096;
+    while (newsize - self->len < size) newsize *= 2;
+    uint8_t *buf = realloc(self->buf, newsize);
+    if (!buf) return -1;
+    self->buf = buf;
+    self->size = newsize;
+    return 0;
+}
+
+Output *Output_createFile(FILE *file)
+{
+    Output *self = create(OS_FILE, 0);
+    if (self) self->file = file;
+    return self;
+}
+
+Output *Output_createFd(int fd, size_t size)
+{
+    Output *self = create(OS_FD, size ? size : 1);
+    if (self) self->fd = fd;
+    return self;
+}
+
+Output *Output_createMemory(void)
+{
+    return create(OS_MEMORY, 0);
+}
+
+void Output_setInterval(Output *self, unsigned interval)
+{
+    self->interval = interval;
+    timespec_get(&self->flushed, TIME_UTC);
+}
+
+int Output_checkInterval(Output *self)
+{
+    if (!self->interval) return 0;
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    if ((now.tv_sec - self->flushed.tv_sec) * 1000
+            + (now.tv_nsec - self->flushed.tv_nsec) / 1000000
+            < self->interval) return 0;
+    return Output_flush(self);
+}
+
+void Output_tee(Output *self, Output *tee)
+{
+    self->tee = tee;
+}
+
+int Output_putc(Output *self, uint8_t byte)
+{
+    if (self->tee) return Output_write(self, &byte, 1);
+    if (self->sink == OS_FILE) return putc(byte, self->file) == EOF ? -1 : 0;
+    if (self->len == self->size) return Output_write(self, &byte, 1);
+    self->buf[self->len++] = byte;
+    return 0;
+}
+
+int Output_write(Output *self, const void *data, size_t size)
+{
+    if (self->tee && Output_write(self->tee, data, size) < 0) return -1;
+    switch (self->sink)
+    {
+        case OS_FILE:
+            return fwrite(data, 1, size, self->file) == size ? 0 : -1;
+        case OS_FD:
+            if (self->size - self->len < size && Output_flush(self) < 0)
+            {
+                return -1;
+            }
+            if (size >= self->size) return writeAll(self->fd, data, size);
+            break;
+        case OS_MEMORY:
+            if (self->size - self->len < size && grow(self, size) < 0)
+            {
+                return -1;
+            }
+            break;
+    }
+    memcpy(self->buf + self->len, data, size);
+    self->len += size;
+    return 0;
+}
+
+int Output_flush(Output *self)
+{
+    if (self->interval) timespec_get(&self->flushed, TIME_UTC);
+    switch (self->sink)
+    {
+        case OS_FILE:
+            return fflush(self->file);
+        case OS_FD:
+            if (writeAll(self->fd, self->buf, self->len) < 0) return -1;
+            self->len = 0;
+            break;
+        case OS_MEMORY:
+            break;
+    }
+    return 0;
+}
+
+const uint8_t *Output_data(const Output *self, size_t *size)
+{
+    if (self->sink != OS_MEMORY) return 0;
+    *size = self->len;
+    return self->buf;
+}
+
+void Output_destroy(Output *self)
+{
+    if (!self) return;
+    if (self->sink == OS_FD) Output_flush(self);
+    free(self->buf);
+    free(self);
+}
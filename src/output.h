@@ -0,0 +1,30 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct Output Output;
+
+/* writes through the stdio buffer of file */
+Output *Output_createFile(FILE *file);
+/* writes to fd with write() through a buffer of size bytes */
+Output *Output_createFd(int fd, size_t size);
+/* collects everything written in memory, see Output_data() */
+Output *Output_createMemory(void);
+/* makes Output_checkInterval() flush when interval milliseconds passed
+ * since the last flush, 0 disables it */
+void Output_setInterval(Output *self, unsigned interval);
+/* for writers done with a piece of output, see Output_setInterval() */
+int Output_checkInterval(Output *self);
+/* copies everything written from now on to tee as well, 0 to stop */
+void Output_tee(Output *self, Output *tee);
+int Output_putc(Output *self, uint8_t byte);
+int Output_write(Output *self, const void *data, size_t size);
+int Output_flush(Output *self);
+/* the bytes written to a memory output so far, 0 for other outputs */
+const uint8_t *Output_data(const Output *self, size_t *size);
+void Output_destroy(Output *self);
+
+#endif
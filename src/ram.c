@@ -2,60 +2,167 @@
 #include <stdint.h>
 #include <string.h>
 
-#include "ram.h"
+#include "ramimpl.h"
+#include "output.h"
 
-#define RAM_PAGESIZE 0x1000
+/* Pages nobody wrote to yet all share the zero page, and clones share all
+ * pages with the original. A page is copied before writing to it unless it
+ * has exactly one reference. Pages of a materialized image (Ram_data())
+ * point to the flat page, which is never shared. Pages of an image mapped
+ * from elsewhere (Ram_createMapped()) point to the mapped page and are
+ * copied on the first write just like the zero page.
+ */
+static RamPage zeroPage;
+static RamPage flatPage = { 1, { 0 } };
+static RamPage mappedPage;
 
-struct Ram
+static void release(RamPage *page)
 {
-    size_t size;
-    size_t capa;
-    uint8_t *m;
-};
+    if (page == &zeroPage || page == &flatPage || page == &mappedPage) return;
+    if (!--page->refs) free(page);
+}
 
-Ram *Ram_create(size_t size, const uint8_t *content)
+static void retain(RamPage *page)
 {
-    if (size > RAM_MAXSIZE) return 0;
-    size_t capa = size + size % RAM_PAGESIZE;
-    Ram *self = malloc(sizeof *self);
-    if (!self) return 0;
-    if (size)
+    if (page != &zeroPage && page != &mappedPage) ++page->refs;
+}
+
+static uint8_t watched(const Ram *self, uint16_t at, size_t size)
+{
+    uint8_t w = 0;
+    for (size_t p = at / RAM_CODEPAGE; p <= (at + size - 1) / RAM_CODEPAGE;
+            ++p)
+    {
+        w |= self->watch[p];
+    }
+    return w;
+}
+
+int Ram_own(Ram *self, unsigned p)
+{
+    RamPage *page = malloc(sizeof *page);
+    if (!page) return -1;
+    page->refs = 1;
+    memcpy(page->data, self->data[p], RAM_PAGESIZE);
+    release(self->page[p]);
+    self->page[p] = page;
+    self->data[p] = page->data;
+    return 0;
+}
+
+static void readRange(const Ram *self, uint16_t at, uint8_t *buf,
+        size_t size)
+{
+    while (size)
     {
-        self->m = malloc(capa);
-        if (!self->m)
+        size_t off = at % RAM_PAGESIZE;
+        size_t chunk = RAM_PAGESIZE - off;
+        if (chunk > size) chunk = size;
+        memcpy(buf, self->data[at / RAM_PAGESIZE] + off, chunk);
+        buf += chunk;
+        at += chunk;
+        size -= chunk;
+    }
+}
+
+/* byte is used instead of data if data is 0 */
+static int writeRange(Ram *self, uint32_t at, const uint8_t *data,
+        uint8_t byte, size_t size)
+{
+    while (size)
+    {
+        unsigned p = at / RAM_PAGESIZE;
+        size_t off = at % RAM_PAGESIZE;
+        size_t chunk = RAM_PAGESIZE - off;
+        if (chunk > size) chunk = size;
+        if (self->page[p]->refs != 1 && Ram_own(self, p) < 0) return -1;
+        if (data)
         {
-            free(self);
-            return 0;
+            memcpy(self->data[p] + off, data, chunk);
+            data += chunk;
         }
+        else memset(self->data[p] + off, byte, chunk);
+        at += chunk;
+        size -= chunk;
     }
-    else
+    return 0;
+}
+
+static int grow(Ram *self, size_t size)
+{
+    if (size > RAM_MAXSIZE) return -1;
+    while (self->npages * RAM_PAGESIZE < size)
     {
-        self->m = 0;
+        self->page[self->npages] = &zeroPage;
+        self->data[self->npages++] = zeroPage.data;
     }
     self->size = size;
-    self->capa = capa;
-    if (content)
+    return 0;
+}
+
+Ram *Ram_create(size_t size, const uint8_t *content)
+{
+    if (size > RAM_MAXSIZE) return 0;
+    Ram *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    grow(self, size);
+    if (content && writeRange(self, 0, content, 0, size) < 0)
+    {
+        Ram_destroy(self);
+        return 0;
+    }
+    return self;
+}
+
+Ram *Ram_createMapped(size_t size, const uint8_t *data)
+{
+    Ram *self = Ram_create(size, 0);
+    if (!self) return 0;
+    if (Ram_map(self, 0, data, size) < 0)
     {
-        memcpy(self->m, content, size);
+        Ram_destroy(self);
+        return 0;
     }
     return self;
 }
 
 Ram *Ram_clone(const Ram *from)
 {
-    Ram *clone = malloc(sizeof *clone);
+    Ram *clone = calloc(1, sizeof *clone);
     if (!clone) return 0;
-    memcpy(clone, from, sizeof *clone);
-    if (clone->m)
+    grow(clone, from->size);
+    for (unsigned p = 0; p < from->npages; ++p)
     {
-        uint8_t *cm = malloc(clone->capa);
-        if (!cm)
+        if (from->page[p] == &flatPage)
         {
-            free(clone);
+            if (writeRange(clone, p * RAM_PAGESIZE, from->data[p], 0,
+                        RAM_PAGESIZE) < 0)
+            {
+                Ram_destroy(clone);
+                return 0;
+            }
+            continue;
+        }
+        clone->page[p] = from->page[p];
+        clone->data[p] = from->data[p];
+        retain(clone->page[p]);
+    }
+    if (from->nbanks)
+    {
+        size_t n = from->nbanks * RAM_BANKPAGES;
+        clone->banks = malloc(n * sizeof *clone->banks);
+        if (!clone->banks)
+        {
+            Ram_destroy(clone);
             return 0;
         }
-        memcpy(cm, clone->m, clone->capa);
-        clone->m = cm;
+        clone->nbanks = from->nbanks;
+        clone->bank = from->bank;
+        for (size_t i = 0; i < n; ++i)
+        {
+            clone->banks[i] = from->banks[i];
+            if (i / RAM_BANKPAGES != from->bank) retain(clone->banks[i]);
+        }
     }
     return clone;
 }
@@ -63,52 +170,97 @@ Ram *Ram_clone(const Ram *from)
 int Ram_load(Ram *self, uint16_t at, const uint8_t *data, size_t size)
 {
     if (size > self->size || size + at > self->size) return -1;
-    memcpy(self->m + at, data, size);
+    if (writeRange(self, at, data, 0, size) < 0) return -1;
+    if (size && watched(self, at, size)) Ram_written(self, at, size);
     return 0;
 }
 
-int Ram_appendByte(Ram *self, uint8_t byte)
+/* whole pages covered by data don't need to be aligned to the pages of
+ * data, only the partial pages at both ends are copied */
+int Ram_map(Ram *self, uint16_t at, const uint8_t *data, size_t size)
 {
-    if (self->size == RAM_MAXSIZE) return -1;
-    if (self->size == self->capa)
+    if (self->flat || self->nbanks) return Ram_load(self, at, data, size);
+    if (size > self->size || size + at > self->size) return -1;
+    if (!size) return 0;
+    size_t head = (RAM_PAGESIZE - at % RAM_PAGESIZE) % RAM_PAGESIZE;
+    if (head > size) head = size;
+    if (writeRange(self, at, data, 0, head) < 0) return -1;
+    size_t done = head;
+    for (; size - done >= RAM_PAGESIZE; done += RAM_PAGESIZE)
+    {
+        unsigned p = (at + done) / RAM_PAGESIZE;
+        release(self->page[p]);
+        self->page[p] = &mappedPage;
+        self->data[p] = (uint8_t *)data + done;
+    }
+    if (writeRange(self, at + done, data + done, 0, size - done) < 0)
     {
-        size_t nc = self->capa + RAM_PAGESIZE;
-        uint8_t *nm = realloc(self->m, nc);
-        if (!nm) return -1;
-        self->m = nm;
-        self->capa = nc;
+        return -1;
     }
-    self->m[self->size++] = byte;
+    if (watched(self, at, size)) Ram_written(self, at, size);
     return 0;
 }
 
+int Ram_appendByte(Ram *self, uint8_t byte)
+{
+    return Ram_append(self, &byte, 1);
+}
+
 int Ram_append(Ram *self, const uint8_t *data, size_t size)
 {
-    if (self->size + size > RAM_MAXSIZE) return -1;
-    if (self->size + size > self->capa)
+    size_t at = self->size;
+    if (grow(self, at + size) < 0) return -1;
+    if (writeRange(self, at, data, 0, size) < 0)
+    {
+        self->size = at;
+        return -1;
+    }
+    return 0;
+}
+
+int Ram_fill(Ram *self, uint16_t at, uint8_t byte, size_t size)
+{
+    if (size > self->size || size + at > self->size) return -1;
+    if (writeRange(self, at, 0, byte, size) < 0) return -1;
+    if (size && watched(self, at, size)) Ram_written(self, at, size);
+    return 0;
+}
+
+/* copies page by page, in the direction that doesn't overwrite source
+ * bytes before they're read */
+int Ram_copy(Ram *self, uint16_t to, uint16_t from, size_t size)
+{
+    uint8_t buf[RAM_PAGESIZE];
+
+    if (size > self->size || size + to > self->size
+            || size + from > self->size) return -1;
+    for (size_t done = 0; done < size;)
     {
-        size_t nc = self->size + size + ((self->size + size) % RAM_PAGESIZE);
-        uint8_t *nm = realloc(self->m, nc);
-        if (!nm) return -1;
-        self->m = nm;
-        self->capa = nc;
+        size_t chunk = size - done;
+        if (chunk > RAM_PAGESIZE) chunk = RAM_PAGESIZE;
+        size_t off = to > from ? size - done - chunk : done;
+        readRange(self, from + off, buf, chunk);
+        if (writeRange(self, to + off, buf, 0, chunk) < 0) return -1;
+        done += chunk;
     }
-    memcpy(self->m + self->size, data, size);
-    self->size += size;
+    if (size && watched(self, to, size)) Ram_written(self, to, size);
     return 0;
 }
 
 int Ram_set(Ram *self, uint16_t at, uint8_t byte)
 {
     if (at >= self->size) return -1;
-    self->m[at] = byte;
+    unsigned p = at / RAM_PAGESIZE;
+    if (self->page[p]->refs != 1 && Ram_own(self, p) < 0) return -1;
+    self->data[p][at % RAM_PAGESIZE] = byte;
+    if (self->watch[at / RAM_CODEPAGE]) Ram_written(self, at, 1);
     return 0;
 }
 
 uint8_t Ram_get(const Ram *self, uint16_t at)
 {
-    if (self->size && (at >= self->size)) return 0;
-    return self->m[at];
+    if (at >= self->size) return 0;
+    return Ram_getFast(self, at);
 }
 
 size_t Ram_size(const Ram *self)
@@ -116,15 +268,368 @@ size_t Ram_size(const Ram *self)
     return self->size;
 }
 
-const uint8_t *Ram_contents(const Ram *self)
+/* forgets all cached strings touching the pages of the given range */
+static void dropText(Ram *self, uint16_t at, size_t size)
+{
+    size_t first = at / RAM_CODEPAGE;
+    size_t last = (at + size - 1) / RAM_CODEPAGE;
+    for (unsigned i = 0; i < RAM_TEXTCACHE; ++i)
+    {
+        RamText *t = self->text + i;
+        if (t->len && t->at / RAM_CODEPAGE <= last
+                && (t->at + t->len) / RAM_CODEPAGE >= first) t->len = 0;
+    }
+    for (size_t p = first; p <= last; ++p) self->watch[p] &= ~RAM_WTEXT;
+}
+
+/* only strings inside a single page are cached, the terminating 0 is
+ * watched as well */
+static void cacheText(Ram *self, uint16_t at, size_t len)
+{
+    RamText *t = self->text + at % RAM_TEXTCACHE;
+    t->at = at;
+    t->len = len;
+    for (size_t p = at / RAM_CODEPAGE; p <= (at + len) / RAM_CODEPAGE; ++p)
+    {
+        self->watch[p] |= RAM_WTEXT;
+    }
+}
+
+int Ram_puts(Ram *self, uint16_t at, Output *out)
+{
+    const RamText *t = self->text + at % RAM_TEXTCACHE;
+    if (t->len && t->at == at)
+    {
+        const uint8_t *p = self->data[at / RAM_PAGESIZE] + at % RAM_PAGESIZE;
+        return Output_write(out, p, t->len);
+    }
+    int first = 1;
+    while (at < self->size)
+    {
+        const uint8_t *p = self->data[at / RAM_PAGESIZE] + at % RAM_PAGESIZE;
+        size_t chunk = RAM_PAGESIZE - at % RAM_PAGESIZE;
+        if (chunk > self->size - at) chunk = self->size - at;
+        const uint8_t *end = memchr(p, 0, chunk);
+        if (end) chunk = end - p;
+        if (Output_write(out, p, chunk) < 0) return -1;
+        if (end)
+        {
+            if (first && chunk && !self->flat) cacheText(self, at, chunk);
+            break;
+        }
+        first = 0;
+        at += chunk;
+        if (!at) break;
+    }
+    return 0;
+}
+
+int Ram_write(const Ram *self, uint16_t at, size_t size, Output *out)
+{
+    if (size > self->size || size + at > self->size) return -1;
+    while (size)
+    {
+        const uint8_t *p = self->data[at / RAM_PAGESIZE] + at % RAM_PAGESIZE;
+        size_t chunk = RAM_PAGESIZE - at % RAM_PAGESIZE;
+        if (chunk > size) chunk = size;
+        if (Output_write(out, p, chunk) < 0) return -1;
+        at += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+static void selectBank(void *ctx, uint16_t at, uint8_t byte)
+{
+    (void)at;
+    Ram_selectBank(ctx, byte);
+}
+
+int Ram_addBanks(Ram *self, unsigned nbanks)
+{
+    if (self->nbanks || nbanks < 2 || nbanks > RAM_MAXBANKS
+            || self->size != RAM_MAXSIZE || self->flat) return -1;
+    for (unsigned p = RAM_WINDOWPAGE; p < RAM_WINDOWPAGE + RAM_BANKPAGES; ++p)
+    {
+        /* swapping pages needs data[p] == page[p]->data */
+        if (self->page[p] == &mappedPage && Ram_own(self, p) < 0) return -1;
+    }
+    self->banks = malloc(nbanks * RAM_BANKPAGES * sizeof *self->banks);
+    if (!self->banks) return -1;
+    for (size_t i = 0; i < nbanks * RAM_BANKPAGES; ++i)
+    {
+        self->banks[i] = &zeroPage;
+    }
+    self->nbanks = nbanks;
+    self->bank = 0;
+    if (Ram_mapDevice(self, RAM_BANKREG, 1, selectBank, self) < 0)
+    {
+        free(self->banks);
+        self->banks = 0;
+        self->nbanks = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void Ram_selectBank(Ram *self, unsigned bank)
+{
+    if (bank >= self->nbanks || bank == self->bank) return;
+    RamPage **from = self->banks + self->bank * RAM_BANKPAGES;
+    RamPage **to = self->banks + bank * RAM_BANKPAGES;
+    for (unsigned i = 0; i < RAM_BANKPAGES; ++i)
+    {
+        unsigned p = RAM_WINDOWPAGE + i;
+        from[i] = self->page[p];
+        self->page[p] = to[i];
+        self->data[p] = to[i]->data;
+    }
+    self->bank = bank;
+    uint8_t w = watched(self, RAM_BANKWINDOW, RAM_BANKSIZE);
+    if (w & RAM_WTEXT) dropText(self, RAM_BANKWINDOW, RAM_BANKSIZE);
+    if (w & RAM_WCODE)
+    {
+        ++self->codewrites;
+        if (self->invalidate)
+        {
+            self->invalidate(self->ctx, RAM_BANKWINDOW, RAM_BANKSIZE);
+        }
+    }
+}
+
+unsigned Ram_banks(const Ram *self)
+{
+    return self->nbanks;
+}
+
+size_t Ram_physSize(const Ram *self)
+{
+    if (!self->nbanks) return self->size;
+    return RAM_MAXSIZE + (self->nbanks - 1) * RAM_BANKSIZE;
+}
+
+/* the slot holding physical page pp if its bank isn't selected, else 0 and
+ * pp's page in the address space in *p */
+static RamPage **bankSlot(const Ram *self, size_t pp, unsigned *p)
+{
+    unsigned bank = 0;
+    *p = pp;
+    if (pp >= RAM_NPAGES)
+    {
+        bank = 1 + (pp - RAM_NPAGES) / RAM_BANKPAGES;
+        *p = RAM_WINDOWPAGE + (pp - RAM_NPAGES) % RAM_BANKPAGES;
+    }
+    if (!self->nbanks || bank == self->bank || *p < RAM_WINDOWPAGE
+            || *p >= RAM_WINDOWPAGE + RAM_BANKPAGES) return 0;
+    return self->banks + bank * RAM_BANKPAGES + *p - RAM_WINDOWPAGE;
+}
+
+static const uint8_t *physData(const Ram *self, size_t pp)
+{
+    unsigned p;
+    RamPage **slot = bankSlot(self, pp, &p);
+    return slot ? (*slot)->data : self->data[p];
+}
+
+uint8_t Ram_physGet(const Ram *self, size_t at)
 {
-    return self->m;
+    if (at >= Ram_physSize(self)) return 0;
+    return physData(self, at / RAM_PAGESIZE)[at % RAM_PAGESIZE];
+}
+
+int Ram_physLoad(Ram *self, size_t at, const uint8_t *data, size_t size)
+{
+    if (size > Ram_physSize(self) || at + size > Ram_physSize(self))
+    {
+        return -1;
+    }
+    while (size)
+    {
+        unsigned p;
+        size_t off = at % RAM_PAGESIZE;
+        size_t chunk = RAM_PAGESIZE - off;
+        if (chunk > size) chunk = size;
+        RamPage **slot = bankSlot(self, at / RAM_PAGESIZE, &p);
+        if (!slot)
+        {
+            if (writeRange(self, p * RAM_PAGESIZE + off, data, 0, chunk) < 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if ((*slot)->refs != 1)
+            {
+                RamPage *page = malloc(sizeof *page);
+                if (!page) return -1;
+                page->refs = 1;
+                memcpy(page->data, (*slot)->data, RAM_PAGESIZE);
+                release(*slot);
+                *slot = page;
+            }
+            memcpy((*slot)->data + off, data, chunk);
+        }
+        data += chunk;
+        at += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+size_t Ram_nextChange(const Ram *self, const Ram *orig, size_t at,
+        size_t *len)
+{
+    size_t size = Ram_physSize(self);
+    if (Ram_physSize(orig) < size) size = Ram_physSize(orig);
+
+    for (; at < size; ++at)
+    {
+        if (physData(self, at / RAM_PAGESIZE)
+                == physData(orig, at / RAM_PAGESIZE))
+        {
+            at = (at / RAM_PAGESIZE + 1) * RAM_PAGESIZE - 1;
+        }
+        else if (Ram_physGet(self, at) != Ram_physGet(orig, at)) break;
+    }
+    if (at >= size) return size;
+    *len = 1;
+    while (at + *len < size
+            && Ram_physGet(self, at + *len) != Ram_physGet(orig, at + *len))
+    {
+        ++*len;
+    }
+    return at;
+}
+
+uint8_t *Ram_data(Ram *self)
+{
+    if (self->flat) return self->flat;
+    if (self->nbanks) return 0;
+    dropText(self, 0, RAM_MAXSIZE);
+    self->flat = malloc(self->npages * RAM_PAGESIZE);
+    if (!self->flat) return 0;
+    for (unsigned p = 0; p < self->npages; ++p)
+    {
+        uint8_t *data = self->flat + p * RAM_PAGESIZE;
+        memcpy(data, self->data[p], RAM_PAGESIZE);
+        release(self->page[p]);
+        self->page[p] = &flatPage;
+        self->data[p] = data;
+    }
+    return self->flat;
+}
+
+void Ram_watchCode(Ram *self, RamInvalidator invalidate, void *ctx)
+{
+    self->invalidate = invalidate;
+    self->ctx = ctx;
+}
+
+void Ram_markCode(Ram *self, uint16_t at, size_t size)
+{
+    if (!size) return;
+    for (size_t p = at / RAM_CODEPAGE; p <= (at + size - 1) / RAM_CODEPAGE
+            && p < sizeof self->watch; ++p)
+    {
+        self->watch[p] |= RAM_WCODE;
+    }
+}
+
+void Ram_clearCode(Ram *self)
+{
+    for (size_t p = 0; p < sizeof self->watch; ++p)
+    {
+        self->watch[p] &= ~RAM_WCODE;
+    }
+}
+
+static void markDevices(Ram *self)
+{
+    for (size_t p = 0; p < sizeof self->watch; ++p)
+    {
+        self->watch[p] &= ~RAM_WDEVICE;
+    }
+    for (unsigned i = 0; i < self->ndevices; ++i)
+    {
+        const RamDeviceMap *d = self->device + i;
+        for (size_t p = d->at / RAM_CODEPAGE;
+                p <= (d->at + d->size - 1) / RAM_CODEPAGE; ++p)
+        {
+            self->watch[p] |= RAM_WDEVICE;
+        }
+    }
+}
+
+int Ram_mapDevice(Ram *self, uint16_t at, size_t size, RamDevice write,
+        void *ctx)
+{
+    if (!size || size > self->size || size + at > self->size
+            || self->ndevices == RAM_MAXDEVICES) return -1;
+    RamDeviceMap *d = self->device + self->ndevices++;
+    d->at = at;
+    d->size = size;
+    d->write = write;
+    d->ctx = ctx;
+    markDevices(self);
+    return 0;
+}
+
+void Ram_unmapDevices(Ram *self, void *ctx)
+{
+    for (unsigned i = 0; i < self->ndevices;)
+    {
+        if (self->device[i].ctx == ctx)
+        {
+            self->device[i] = self->device[--self->ndevices];
+        }
+        else ++i;
+    }
+    markDevices(self);
+}
+
+void Ram_written(Ram *self, uint16_t at, size_t size)
+{
+    uint8_t w = watched(self, at, size);
+    if (w & RAM_WDEVICE)
+    {
+        for (unsigned i = 0; i < self->ndevices; ++i)
+        {
+            const RamDeviceMap *d = self->device + i;
+            size_t from = at > d->at ? at : d->at;
+            size_t to = at + size < d->at + d->size
+                ? at + size : d->at + d->size;
+            for (size_t a = from; a < to; ++a)
+            {
+                d->write(d->ctx, a, Ram_getFast(self, a));
+            }
+        }
+    }
+    if (w & RAM_WTEXT) dropText(self, at, size);
+    if (w & RAM_WCODE)
+    {
+        ++self->codewrites;
+        if (self->invalidate) self->invalidate(self->ctx, at, size);
+    }
+}
+
+uint64_t Ram_codeWrites(const Ram *self)
+{
+    return self->codewrites;
 }
 
 void Ram_destroy(Ram *self)
 {
     if (!self) return;
-    free(self->m);
+    for (unsigned p = 0; p < self->npages; ++p)
+    {
+        release(self->page[p]);
+    }
+    for (size_t i = 0; i < self->nbanks * RAM_BANKPAGES; ++i)
+    {
+        if (i / RAM_BANKPAGES != self->bank) release(self->banks[i]);
+    }
+    free(self->banks);
+    free(self->flat);
     free(self);
 }
-
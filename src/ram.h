@@ -1,21 +1,81 @@
 #ifndef RAM_H
 #define RAM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define RAM_MAXSIZE 0x10000
+#define RAM_PAGESIZE 0x1000
+#define RAM_CODEPAGE 0x100
+
+/* With banks, a store to RAM_BANKREG selects which bank appears in the
+ * window at RAM_BANKWINDOW. The physical image is the address space with
+ * bank 0 selected, followed by banks 1 to n-1. */
+#define RAM_BANKWINDOW 0x8000
+#define RAM_BANKSIZE 0x4000
+#define RAM_BANKREG 0xffff
+#define RAM_MAXBANKS 256
 
 typedef struct Ram Ram;
+typedef struct Output Output;
+
+/* called when a write hits a page marked as containing code */
+typedef void (*RamInvalidator)(void *ctx, uint16_t at, size_t size);
+
+/* called after a byte was written to a mapped device register */
+typedef void (*RamDevice)(void *ctx, uint16_t at, uint8_t byte);
 
 Ram *Ram_create(size_t size, const uint8_t *content);
+/* uses data directly for all whole pages until they're written, data must
+ * stay valid as long as the Ram or any of its clones exist */
+Ram *Ram_createMapped(size_t size, const uint8_t *data);
 Ram *Ram_clone(const Ram *from);
 int Ram_load(Ram *self, uint16_t at, const uint8_t *data, size_t size);
+/* like Ram_load(), but uses data directly for whole pages like
+ * Ram_createMapped(), with the same requirement */
+int Ram_map(Ram *self, uint16_t at, const uint8_t *data, size_t size);
 int Ram_appendByte(Ram *self, uint8_t byte);
 int Ram_append(Ram *self, const uint8_t *data, size_t size);
+int Ram_fill(Ram *self, uint16_t at, uint8_t byte, size_t size);
+int Ram_copy(Ram *self, uint16_t to, uint16_t from, size_t size);
 int Ram_set(Ram *self, uint16_t at, uint8_t byte);
 uint8_t Ram_get(const Ram *self, uint16_t at);
 size_t Ram_size(const Ram *self);
-const uint8_t *Ram_contents(const Ram *self);
+/* writes the string at at, up to the end of the Ram. The lengths of
+ * strings are cached and the pages holding them watched for writes, unless
+ * the Ram was materialized with Ram_data(). */
+int Ram_puts(Ram *self, uint16_t at, Output *out);
+/* writes size bytes from at, which must all be inside the Ram */
+int Ram_write(const Ram *self, uint16_t at, size_t size, Output *out);
+/* needs a full 64KB Ram, that wasn't materialized with Ram_data() */
+int Ram_addBanks(Ram *self, unsigned nbanks);
+void Ram_selectBank(Ram *self, unsigned bank);
+unsigned Ram_banks(const Ram *self);
+size_t Ram_physSize(const Ram *self);
+uint8_t Ram_physGet(const Ram *self, size_t at);
+/* for loaders, doesn't report writes to code or devices */
+int Ram_physLoad(Ram *self, size_t at, const uint8_t *data, size_t size);
+/* finds the next run of bytes in the physical image from at on differing
+ * from orig, returns its start and sets *len, or returns the physical size
+ * if there is none. Pages still shared with orig are skipped without
+ * comparing. */
+size_t Ram_nextChange(const Ram *self, const Ram *orig, size_t at,
+        size_t *len);
+/* the image as one flat array, the size must not change afterwards, not
+ * available with banks */
+uint8_t *Ram_data(Ram *self);
+void Ram_watchCode(Ram *self, RamInvalidator invalidate, void *ctx);
+void Ram_markCode(Ram *self, uint16_t at, size_t size);
+void Ram_clearCode(Ram *self);
+/* Writes to device registers are dispatched from the same check that
+ * tracks writes to code, so other addresses don't pay for devices. Reads
+ * aren't trapped, devices put anything to read in the Ram themselves. */
+int Ram_mapDevice(Ram *self, uint16_t at, size_t size, RamDevice write,
+        void *ctx);
+void Ram_unmapDevices(Ram *self, void *ctx);
+/* for writes to code or devices done directly through Ram_data() */
+void Ram_written(Ram *self, uint16_t at, size_t size);
+uint64_t Ram_codeWrites(const Ram *self);
 void Ram_destroy(Ram *self);
 
 #endif
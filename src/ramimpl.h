@@ -0,0 +1,103 @@
+#ifndef RAMIMPL_H
+#define RAMIMPL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ram.h"
+
+#define RAM_NPAGES (RAM_MAXSIZE / RAM_PAGESIZE)
+#define RAM_MAXDEVICES 16
+#define RAM_BANKPAGES (RAM_BANKSIZE / RAM_PAGESIZE)
+#define RAM_WINDOWPAGE (RAM_BANKWINDOW / RAM_PAGESIZE)
+
+/* bits in Ram.watch */
+#define RAM_WCODE 1
+#define RAM_WDEVICE 2
+#define RAM_WTEXT 4
+
+#define RAM_TEXTCACHE 64
+
+typedef struct RamPage
+{
+    unsigned refs;
+    uint8_t data[RAM_PAGESIZE];
+} RamPage;
+
+typedef struct RamDeviceMap
+{
+    size_t at;
+    size_t size;
+    RamDevice write;
+    void *ctx;
+} RamDeviceMap;
+
+/* a string printed by Ram_puts(), len 0 means unused */
+typedef struct RamText
+{
+    uint16_t at;
+    uint16_t len;
+} RamText;
+
+struct Ram
+{
+    size_t size;
+    unsigned npages;
+    uint8_t *data[RAM_NPAGES];
+    RamPage *page[RAM_NPAGES];
+    uint8_t *flat;
+    RamInvalidator invalidate;
+    void *ctx;
+    uint64_t codewrites;
+    unsigned ndevices;
+    RamDeviceMap device[RAM_MAXDEVICES];
+    unsigned nbanks;
+    unsigned bank;
+    /* RAM_BANKPAGES pages per bank, the entries of the selected bank are
+     * stale, its pages are in page[] */
+    RamPage **banks;
+    RamText text[RAM_TEXTCACHE];
+    uint8_t watch[RAM_MAXSIZE / RAM_CODEPAGE];
+};
+
+/* gives page p its own copy */
+int Ram_own(Ram *self, unsigned p);
+
+/* Unchecked access for the hot paths of the engines. The caller must make
+ * sure at is below Ram_size(), which is always true for a full 64KB image.
+ */
+static inline uint8_t Ram_getFast(const Ram *self, uint16_t at)
+{
+    return self->data[at / RAM_PAGESIZE][at % RAM_PAGESIZE];
+}
+
+static inline void Ram_setFast(Ram *self, uint16_t at, uint8_t byte)
+{
+    unsigned p = at / RAM_PAGESIZE;
+    if (self->page[p]->refs != 1 && Ram_own(self, p) < 0) return;
+    self->data[p][at % RAM_PAGESIZE] = byte;
+    if (self->watch[at / RAM_CODEPAGE]) Ram_written(self, at, 1);
+}
+
+/* for a full image materialized with Ram_data(), flat is the pointer it
+ * returned */
+static inline void Ram_setFlat(Ram *self, uint8_t *flat, uint16_t at,
+        uint8_t byte)
+{
+    flat[at] = byte;
+    if (self->watch[at / RAM_CODEPAGE]) Ram_written(self, at, 1);
+}
+
+/* bulk writes can't replace single stores hitting device registers, the
+ * devices must see every store in order */
+static inline int Ram_hasDevice(const Ram *self, uint16_t at, size_t size)
+{
+    for (size_t p = at / RAM_CODEPAGE; p <= (at + size - 1) / RAM_CODEPAGE;
+            ++p)
+    {
+        if (self->watch[p] & RAM_WDEVICE) return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "snapshot.h"
+#include "image.h"
+#include "cpuimpl.h"
+#include "ramimpl.h"
+
+/* A snapshot file starts with a header holding the CPU state:
+ *
+ *   0  "GVMS"      magic
+ *   4  version     currently 2
+ *   5  flags       CpuFlags
+ *   6  pc          16bit little endian
+ *   8  sp          16bit little endian
+ *  10  a, x, y
+ *  13  ram size    32bit little endian
+ *  17  stack       256 bytes
+ * 273  output size 32bit little endian
+ *
+ * The RAM image follows at offset RAM_PAGESIZE, so it can be mapped and
+ * used as the backing of the Ram directly. After it, the output the
+ * program wrote before the snapshot was taken is stored, so it can be
+ * written again when resuming.
+ */
+
+#define HDR_VERSION 4
+#define HDR_FLAGS 5
+#define HDR_PC 6
+#define HDR_SP 8
+#define HDR_REGS 10
+#define HDR_SIZE 13
+#define HDR_STACK 17
+#define HDR_OUTSIZE (HDR_STACK + 256)
+#define HDR_END (HDR_OUTSIZE + 4)
+
+#define VERSION 2
+
+struct Snapshot
+{
+    Image *image;
+    const uint8_t *data;
+    size_t size;
+};
+
+static size_t getSize(const uint8_t *at)
+{
+    size_t size = 0;
+    for (int i = 0; i < 4; ++i) size |= (size_t)at[i] << (8 * i);
+    return size;
+}
+
+int Snapshot_save(const Cpu *cpu, const uint8_t *output, size_t outsize,
+        FILE *out)
+{
+    uint8_t hdr[RAM_PAGESIZE] = { 'G', 'V', 'M', 'S', VERSION };
+    const Ram *ram = cpu->ram;
+
+    if (ram->nbanks || outsize > 0xffffffffU) return -1;
+    hdr[HDR_FLAGS] = FLAGS(cpu->flags);
+    hdr[HDR_PC] = cpu->pc;
+    hdr[HDR_PC + 1] = cpu->pc >> 8;
+    hdr[HDR_SP] = cpu->sp;
+    hdr[HDR_SP + 1] = cpu->sp >> 8;
+    memcpy(hdr + HDR_REGS, cpu->regs, 3);
+    for (int i = 0; i < 4; ++i) hdr[HDR_SIZE + i] = ram->size >> (8 * i);
+    memcpy(hdr + HDR_STACK, cpu->stack, 256);
+    for (int i = 0; i < 4; ++i) hdr[HDR_OUTSIZE + i] = outsize >> (8 * i);
+    if (fwrite(hdr, 1, sizeof hdr, out) != sizeof hdr) return -1;
+
+    for (unsigned p = 0; p < ram->npages; ++p)
+    {
+        size_t chunk = ram->size - p * RAM_PAGESIZE;
+        if (chunk > RAM_PAGESIZE) chunk = RAM_PAGESIZE;
+        if (fwrite(ram->data[p], 1, chunk, out) != chunk) return -1;
+    }
+    if (outsize && fwrite(output, 1, outsize, out) != outsize) return -1;
+    return fflush(out);
+}
+
+Snapshot *Snapshot_open(const char *path)
+{
+    Snapshot *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+
+    self->image = Image_open(path, SIZE_MAX);
+    if (!self->image) goto error;
+    self->data = Image_data(self->image);
+    self->size = Image_size(self->image);
+
+    if (self->size < HDR_END
+            || memcmp(self->data, "GVMS", 4)
+            || self->data[HDR_VERSION] != VERSION
+            || !Snapshot_ramSize(self)
+            || Snapshot_ramSize(self) > RAM_MAXSIZE
+            || self->size < RAM_PAGESIZE + Snapshot_ramSize(self)
+            || self->size - RAM_PAGESIZE - Snapshot_ramSize(self)
+                < getSize(self->data + HDR_OUTSIZE)) goto error;
+    return self;
+
+error:
+    Snapshot_close(self);
+    return 0;
+}
+
+size_t Snapshot_ramSize(const Snapshot *self)
+{
+    if (self->size < HDR_END) return 0;
+    return getSize(self->data + HDR_SIZE);
+}
+
+const uint8_t *Snapshot_output(const Snapshot *self, size_t *size)
+{
+    *size = getSize(self->data + HDR_OUTSIZE);
+    return self->data + RAM_PAGESIZE + Snapshot_ramSize(self);
+}
+
+Ram *Snapshot_ram(const Snapshot *self)
+{
+    return Ram_createMapped(Snapshot_ramSize(self),
+            self->data + RAM_PAGESIZE);
+}
+
+int Snapshot_restore(const Snapshot *self, Cpu *cpu)
+{
+    const uint8_t *hdr = self->data;
+    uint16_t pc = hdr[HDR_PC] | hdr[HDR_PC + 1] << 8;
+    uint16_t sp = hdr[HDR_SP] | hdr[HDR_SP + 1] << 8;
+
+    if (pc >= Ram_size(cpu->ram) || sp > 256) return -1;
+    cpu->pc = pc;
+    cpu->sp = sp;
+    memcpy(cpu->regs, hdr + HDR_REGS, 3);
+    memcpy(cpu->stack, hdr + HDR_STACK, 256);
+    cpu->flags.zres = !(hdr[HDR_FLAGS] & CF_ZERO);
+    cpu->flags.nres = hdr[HDR_FLAGS] & CF_NEGATIVE ? 0x80 : 0;
+    cpu->flags.carry = !!(hdr[HDR_FLAGS] & CF_CARRY);
+    return 0;
+}
+
+void Snapshot_close(Snapshot *self)
+{
+    if (!self) return;
+    Image_close(self->image);
+    free(self);
+}
@@ -0,0 +1,26 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct Cpu Cpu;
+typedef struct Ram Ram;
+typedef struct Snapshot Snapshot;
+
+/* output holds what the program wrote so far, to be written again when
+ * resuming */
+int Snapshot_save(const Cpu *cpu, const uint8_t *output, size_t outsize,
+        FILE *out);
+Snapshot *Snapshot_open(const char *path);
+size_t Snapshot_ramSize(const Snapshot *self);
+/* the Ram uses the snapshot's image until written, so it must be destroyed
+ * before closing the snapshot */
+Ram *Snapshot_ram(const Snapshot *self);
+/* the output saved with the snapshot */
+const uint8_t *Snapshot_output(const Snapshot *self, size_t *size);
+int Snapshot_restore(const Snapshot *self, Cpu *cpu);
+void Snapshot_close(Snapshot *self);
+
+#endif
@@ -1,7 +1,10 @@
-gvm_MODULES:= main help vm asm cpu ram converter symbol opcode
+gvm_MODULES:= main help vm asm aot cpu input output tracer verifier tcode jit snapshot image mmio ram converter hexreader symbol opcode
 ifeq ($(PLATFORM),win32)
 gvm_MODULES+= builtin_getopt
 gvm_DEFINES+= -DBUILTIN_GETOPT
+else
+gvm_DEFINES+= -DTRACER_THREAD
+gvm_LIBS+= pthread
 endif
 $(call binrules, gvm)
 
@@ -0,0 +1,632 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "tcode.h"
+#include "cpuimpl.h"
+#include "ramimpl.h"
+#include "opcode.h"
+
+/* Threaded code engine: every instruction is decoded only once into an Insn
+ * record (handler index and operand) cached by its address, and execution
+ * jumps from handler to handler using computed gotos. Anything rare,
+ * anything doing I/O and all error conditions are delegated to Cpu_step(),
+ * so the semantics stay exactly the same.
+ *
+ * Some common sequences are fused into a single handler at decode time. The
+ * instructions following the first one keep their own Insn records, so they
+ * can still be jump targets, and a fused handler only runs after checking
+ * these are decoded as expected. Otherwise it just executes its first
+ * instruction, so self-modifying code needs no special handling.
+ *
+ * Loops filling or copying memory with an indexed STA, DEX or DEY and BNE
+ * are fused as a whole and run as one bulk operation on the Ram, as long as
+ * they don't overwrite themselves and the result is the same.
+ *
+ * Pages holding decoded instructions are marked in the Ram, which reports
+ * every write hitting them, including those done by Cpu_step(). The
+ * affected records are just reset to be decoded again.
+ */
+
+#ifdef __GNUC__
+
+#define TC_MMOPS(X) \
+    X(LDA) X(STA) X(LDX) X(STX) X(LDY) X(STY) X(AND) X(ORA) X(EOR) \
+    X(LSR) X(ASL) X(ROR) X(ROL) X(ADC) X(SBC) X(INC) X(DEC) \
+    X(CMP) X(CPX) X(CPY)
+
+#define TC_MODES(X, o) \
+    X(o, IMM) X(o, ABS) X(o, ZP) X(o, ABX) \
+    X(o, ZPX) X(o, ABY) X(o, ZPY) X(o, IZY)
+
+#define TC_IMPLICIT(X) \
+    X(RTS) X(SRA) X(SLA) X(RRA) X(RLA) X(INA) X(DEA) X(INX) X(DEX) \
+    X(INY) X(DEY) X(SEZ) X(CLZ) X(SEN) X(CLN) X(SEC) X(CLC) \
+    X(TAX) X(TXA) X(TAY) X(TYA) X(TXY) X(TYX) \
+    X(PHA) X(PLA) X(PHX) X(PLX) X(PHY) X(PLY)
+
+/* fused sequences, LDA/CMP #/BNE exists for every mode of LDA */
+enum
+{
+    F_LDA_CMP_BNE,
+    F_INX_CPX_BNE = F_LDA_CMP_BNE + 8,
+    F_INY_CPY_BNE,
+    F_DEX_BNE,
+    F_DEY_BNE,
+    F_LDA_ZPX_STA_ABY,
+    F_FILL_X,
+    F_FILL_Y,
+    F_COPY_X,
+    F_COPY_Y,
+    F_COUNT
+};
+
+#define F_LCB_NAME(o, m) #o " " #m " / CMP IMM / BNE",
+static const char *const fusedNames[] = {
+    TC_MODES(F_LCB_NAME, LDA)
+    "INX / CPX IMM / BNE",
+    "INY / CPY IMM / BNE",
+    "DEX / BNE",
+    "DEY / BNE",
+    "LDA ZPX / STA ABY",
+    "fill: STA ABX / DEX / BNE",
+    "fill: STA ABY / DEY / BNE",
+    "copy: LDA ABX / STA ABX / DEX / BNE",
+    "copy: LDA ABY / STA ABY / DEY / BNE"
+};
+
+/* handler indices, the order of each group follows the opcode values */
+#define H_MODE(o, m) H_##o##_##m,
+#define H_MM(o) TC_MODES(H_MODE, o)
+#define H_IMP(o) H_##o,
+#define H_BR(o, v) H_##o##_REL, H_##o##_ABS,
+enum
+{
+    H_DECODE,
+    H_SLOW,
+    TC_MMOPS(H_MM)
+    TC_IMPLICIT(H_IMP)
+    ISA_BRANCH(H_BR)
+    H_FUSED
+};
+
+typedef struct Insn
+{
+    uint16_t h;
+    uint16_t arg;
+} Insn;
+
+struct Tcode
+{
+    Cpu *cpu;
+    uint64_t fused[F_COUNT];
+    Insn insn[RAM_MAXSIZE];
+};
+
+static unsigned decodeInsn(Tcode *self, uint16_t pc, Insn *insn)
+{
+    const Ram *ram = self->cpu->ram;
+    size_t size = Ram_size(ram);
+    uint8_t op = Ram_get(ram, pc);
+    uint8_t arg1 = Ram_get(ram, pc + 1);
+    uint16_t arg = arg1;
+    unsigned len = 2;
+    uint16_t h = H_SLOW;
+    int target;
+
+    if ((op & O_AM_IMPLICIT) != O_AM_IMPLICIT)
+    {
+        if (op >= O_WUD) goto done;
+        switch (op & 7)
+        {
+            case O_AM_IMMEDIATE:
+                arg = pc + 1;
+                if (arg >= size) goto done;
+                break;
+            case O_AM_ABSOLUTE:
+                len = 3;
+                arg |= Ram_get(ram, pc + 2) << 8;
+                if (arg >= size) goto done;
+                break;
+            case O_AM_IDX_X:
+            case O_AM_IDX_Y:
+                len = 3;
+                arg |= Ram_get(ram, pc + 2) << 8;
+                break;
+            case O_AM_ZP_ABS:
+                if (arg >= size) goto done;
+                break;
+            case O_AM_ZP_IND_Y:
+                if ((size_t)arg + 1 >= size) goto done;
+                break;
+        }
+        h = H_LDA_IMM + op;
+    }
+    else if ((op & O_AM_JUMP) == O_AM_JUMP)
+    {
+        if (op & O_AM_ABSOLUTE)
+        {
+            len = 3;
+            arg |= Ram_get(ram, pc + 2) << 8;
+        }
+        else
+        {
+            target = (uint16_t)(pc + 2) + (int8_t)arg1;
+            if (target < 0) goto done;
+            arg = target;
+        }
+        if (arg >= size) goto done;
+        h = H_BSR_REL + (op - O_BSR);
+    }
+    else if (op >= O_RTS && op <= O_PLY)
+    {
+        len = 1;
+        h = H_RTS + (op - O_RTS);
+    }
+
+    /* near the end of a small RAM, leave the exact behavior to Cpu_step() */
+    if (size < RAM_MAXSIZE && pc + len >= size) h = H_SLOW;
+
+done:
+    insn->h = h;
+    insn->arg = arg;
+    return len;
+}
+
+/* instructions not decoded yet are left alone, so they can still become
+ * the first instruction of a fused sequence themselves */
+static int follows(Tcode *self, uint32_t pc, uint16_t h)
+{
+    Insn insn;
+
+    if (pc >= Ram_size(self->cpu->ram)) return 0;
+    if (self->insn[pc].h != H_DECODE) return self->insn[pc].h == h;
+    decodeInsn(self, pc, &insn);
+    return insn.h == h;
+}
+
+/* DEX or DEY, possibly fused already, and a BNE back to the loop start */
+static int loopEnd(Tcode *self, uint32_t pc, uint16_t dec, uint16_t fdec,
+        uint16_t start)
+{
+    Insn insn;
+
+    if (!follows(self, pc, dec) && !follows(self, pc, fdec)) return 0;
+    if (!follows(self, ++pc, H_BNE_REL)) return 0;
+    if (self->insn[pc].h == H_DECODE) decodeInsn(self, pc, &insn);
+    else insn = self->insn[pc];
+    return insn.arg == start;
+}
+
+static void decode(Tcode *self, uint16_t pc)
+{
+    Insn *insn = self->insn + pc;
+    uint32_t next = pc + decodeInsn(self, pc, insn);
+    uint16_t h = insn->h;
+
+    Ram_markCode(self->cpu->ram, pc, next - pc);
+
+    if (h >= H_LDA_IMM && h <= H_LDA_IZY)
+    {
+        if (follows(self, next, H_CMP_IMM)
+                && follows(self, next + 2, H_BNE_REL))
+        {
+            insn->h = H_FUSED + F_LDA_CMP_BNE + (h - H_LDA_IMM);
+        }
+        else if (h == H_LDA_ZPX && follows(self, next, H_STA_ABY))
+        {
+            insn->h = H_FUSED + F_LDA_ZPX_STA_ABY;
+        }
+        else if (h == H_LDA_ABX && follows(self, next, H_STA_ABX)
+                && loopEnd(self, next + 3, H_DEX, H_FUSED + F_DEX_BNE, pc))
+        {
+            insn->h = H_FUSED + F_COPY_X;
+        }
+        else if (h == H_LDA_ABY && follows(self, next, H_STA_ABY)
+                && loopEnd(self, next + 3, H_DEY, H_FUSED + F_DEY_BNE, pc))
+        {
+            insn->h = H_FUSED + F_COPY_Y;
+        }
+    }
+    else if (h == H_STA_ABX)
+    {
+        if (loopEnd(self, next, H_DEX, H_FUSED + F_DEX_BNE, pc))
+        {
+            insn->h = H_FUSED + F_FILL_X;
+        }
+    }
+    else if (h == H_STA_ABY)
+    {
+        if (loopEnd(self, next, H_DEY, H_FUSED + F_DEY_BNE, pc))
+        {
+            insn->h = H_FUSED + F_FILL_Y;
+        }
+    }
+    else if (h == H_INX)
+    {
+        if (follows(self, next, H_CPX_IMM)
+                && follows(self, next + 2, H_BNE_REL))
+        {
+            insn->h = H_FUSED + F_INX_CPX_BNE;
+        }
+    }
+    else if (h == H_INY)
+    {
+        if (follows(self, next, H_CPY_IMM)
+                && follows(self, next + 2, H_BNE_REL))
+        {
+            insn->h = H_FUSED + F_INY_CPY_BNE;
+        }
+    }
+    else if (h == H_DEX)
+    {
+        if (follows(self, next, H_BNE_REL)) insn->h = H_FUSED + F_DEX_BNE;
+    }
+    else if (h == H_DEY)
+    {
+        if (follows(self, next, H_BNE_REL)) insn->h = H_FUSED + F_DEY_BNE;
+    }
+}
+
+/* an instruction occupies up to 3 bytes, so a write can hit the operand
+ * of an instruction starting up to 2 bytes before */
+static void invalidate(void *ctx, uint16_t at, size_t size)
+{
+    Tcode *self = ctx;
+    uint16_t pc = at - 2;
+    for (size_t i = 0; i < size + 2; ++i)
+    {
+        self->insn[pc++].h = H_DECODE;
+    }
+}
+
+Tcode *Tcode_create(Cpu *cpu)
+{
+    Tcode *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    self->cpu = cpu;
+    Ram_watchCode(cpu->ram, invalidate, self);
+    return self;
+}
+
+#define LOAD() do { \
+    pc = cpu->pc; \
+    sp = cpu->sp; \
+    flags = cpu->flags; \
+    a = cpu->regs[CR_A]; \
+    x = cpu->regs[CR_X]; \
+    y = cpu->regs[CR_Y]; \
+} while(0)
+
+#define SAVE() do { \
+    cpu->pc = pc; \
+    cpu->sp = sp; \
+    cpu->flags = flags; \
+    cpu->regs[CR_A] = a; \
+    cpu->regs[CR_X] = x; \
+    cpu->regs[CR_Y] = y; \
+} while(0)
+
+#define DISPATCH() do { \
+    ip = insn + pc; \
+    goto *handlers[ip->h]; \
+} while(0)
+
+#define NEXT(n) do { \
+    pc += (n); \
+    DISPATCH(); \
+} while(0)
+
+#define JUMP() do { \
+    pc = ip->arg; \
+    DISPATCH(); \
+} while(0)
+
+/* every address is checked against the size first, leaving edge cases to
+ * Cpu_step(), so memory is accessed without any further checks */
+#define STORE(at, v) Ram_setFast(ram, (at), (v))
+
+#define LD(at) Ram_getFast(ram, (at))
+
+#define EA_IMM addr = ip->arg
+#define EA_ABS addr = ip->arg
+#define EA_ZP addr = ip->arg
+#define EA_ABX addr = ip->arg + x; if (addr >= size) goto slow
+#define EA_ZPX addr = ip->arg + x; if (addr >= size) goto slow
+#define EA_ABY addr = ip->arg + y; if (addr >= size) goto slow
+#define EA_ZPY addr = ip->arg + y; if (addr >= size) goto slow
+#define EA_IZY addr = (LD(ip->arg) | LD(ip->arg + 1) << 8) + y; \
+    if (addr >= size) goto slow
+
+#define LEN_IMM 2
+#define LEN_ABS 3
+#define LEN_ZP 2
+#define LEN_ABX 3
+#define LEN_ZPX 2
+#define LEN_ABY 3
+#define LEN_ZPY 2
+#define LEN_IZY 2
+
+#define OP_LDA a = LD(addr); NZ(flags, a)
+#define OP_STA STORE(addr, a)
+#define OP_LDX x = LD(addr); NZ(flags, x)
+#define OP_STX STORE(addr, x)
+#define OP_LDY y = LD(addr); NZ(flags, y)
+#define OP_STY STORE(addr, y)
+#define OP_AND a &= LD(addr); NZ(flags, a)
+#define OP_ORA a |= LD(addr); NZ(flags, a)
+#define OP_EOR a ^= LD(addr); NZ(flags, a)
+#define OP_LSR v = LD(addr); SR(flags, v); NZ(flags, v); STORE(addr, v)
+#define OP_ASL v = LD(addr); SL(flags, v); NZ(flags, v); STORE(addr, v)
+#define OP_ROR v = LD(addr); RR(flags, v); NZ(flags, v); STORE(addr, v)
+#define OP_ROL v = LD(addr); RL(flags, v); NZ(flags, v); STORE(addr, v)
+#define OP_ADC v = LD(addr); ADC(flags, a, v)
+#define OP_SBC v = LD(addr); SBC(flags, a, v)
+#define OP_INC v = LD(addr) + 1; NZ(flags, v); STORE(addr, v)
+#define OP_DEC v = LD(addr) - 1; NZ(flags, v); STORE(addr, v)
+#define OP_CMP v = LD(addr); CMP(flags, a, v)
+#define OP_CPX v = LD(addr); CMP(flags, x, v)
+#define OP_CPY v = LD(addr); CMP(flags, y, v)
+
+#define COND_BRA 1
+#define COND_BNE !FLAG_Z(flags)
+#define COND_BEQ FLAG_Z(flags)
+#define COND_BPL !FLAG_N(flags)
+#define COND_BMI FLAG_N(flags)
+#define COND_BCC !FLAG_C(flags)
+#define COND_BCS FLAG_C(flags)
+
+#define MM_HANDLER(o, m) L_##o##_##m: EA_##m; OP_##o; NEXT(LEN_##m);
+#define MM_HANDLERS(o) TC_MODES(MM_HANDLER, o)
+
+#define BR_HANDLERS(o) \
+    L_##o##_REL: if (COND_##o) JUMP(); NEXT(2); \
+    L_##o##_ABS: if (COND_##o) JUMP(); NEXT(3);
+
+#define BSR_HANDLER(m, n) \
+    L_BSR_##m: \
+    if (sp >= 255) goto slow; \
+    addr = pc + (n); \
+    cpu->stack[sp++] = addr & 0xff; \
+    cpu->stack[sp++] = addr >> 8; \
+    JUMP();
+
+/* fused handlers check the following instructions, then run them in order
+ * while advancing ip to each of them */
+#define LCB_HANDLER(o, m) \
+    L_LCB_##m: \
+    if (ip[LEN_##m].h != H_CMP_IMM || ip[LEN_##m + 2].h != H_BNE_REL) \
+        goto L_LDA_##m; \
+    EA_##m; \
+    ++fused[F_LDA_CMP_BNE + H_LDA_##m - H_LDA_IMM]; \
+    OP_LDA; \
+    ip += LEN_##m; \
+    EA_IMM; OP_CMP; \
+    ip += 2; \
+    if (COND_BNE) JUMP(); \
+    NEXT(LEN_##m + 4);
+
+#define ICB_HANDLER(r, i, c) \
+    L_##i##_##c##_BNE: \
+    if (ip[1].h != H_##c##_IMM || ip[3].h != H_BNE_REL) goto L_##i; \
+    ++fused[F_##i##_##c##_BNE]; \
+    ++r; NZ(flags, r); \
+    ++ip; \
+    EA_IMM; OP_##c; \
+    ip += 2; \
+    if (COND_BNE) JUMP(); \
+    NEXT(5);
+
+#define DB_HANDLER(r, i) \
+    L_##i##_BNE: \
+    if (ip[1].h != H_BNE_REL) goto L_##i; \
+    ++fused[F_##i##_BNE]; \
+    --r; NZ(flags, r); \
+    ++ip; \
+    if (COND_BNE) JUMP(); \
+    NEXT(3);
+
+#define LOOPEND(o, i) ((ip[o].h == H_##i || ip[o].h == H_FUSED + F_##i##_BNE) \
+        && ip[(o) + 1].h == H_BNE_REL && ip[(o) + 1].arg == pc)
+
+#define OVERLAPS(a, an, b, bn) ((a) < (b) + (bn) && (b) < (a) + (an))
+
+/* with a register value of 0, the loop runs 256 times, starting at 0 */
+#define FILL_HANDLER(r, R, i) \
+    L_FILL_##R: \
+    if (!LOOPEND(3, i)) goto L_STA_AB##R; \
+    n = r ? r : 256; \
+    to = ip->arg + !!r; \
+    if (to + n > size || OVERLAPS(to, n, pc, 6U) \
+            || Ram_hasDevice(ram, to, n)) goto L_STA_AB##R; \
+    ++fused[F_FILL_##R]; \
+    Ram_fill(ram, to, a, n); \
+    r = 0; NZ(flags, r); \
+    NEXT(6);
+
+/* copying downwards only equals memmove() if the destination isn't below
+ * an overlapping source */
+#define COPY_HANDLER(r, R, i) \
+    L_COPY_##R: \
+    if (ip[3].h != H_STA_AB##R || !LOOPEND(6, i)) goto L_LDA_AB##R; \
+    n = r ? r : 256; \
+    from = ip->arg + !!r; \
+    to = ip[3].arg + !!r; \
+    if (from + n > size || to + n > size || OVERLAPS(to, n, pc, 9U) \
+            || ((!r || to < from) && OVERLAPS(to, n, from, n)) \
+            || Ram_hasDevice(ram, to, n)) \
+        goto L_LDA_AB##R; \
+    ++fused[F_COPY_##R]; \
+    Ram_copy(ram, to, from, n); \
+    a = LD(ip->arg + 1); \
+    r = 0; NZ(flags, r); \
+    NEXT(9);
+
+#define PUSH(r) do { \
+    if (sp == 256) goto slow; \
+    cpu->stack[sp++] = (r); \
+    NEXT(1); \
+} while(0)
+
+#define PULL(r) do { \
+    if (!sp) goto slow; \
+    (r) = cpu->stack[--sp]; \
+    NEXT(1); \
+} while(0)
+
+#define L_MODE(o, m) &&L_##o##_##m,
+#define L_MM(o) TC_MODES(L_MODE, o)
+#define L_IMP(o) &&L_##o,
+#define L_BR(o, v) &&L_##o##_REL, &&L_##o##_ABS,
+#define L_LCB(o, m) &&L_LCB_##m,
+
+int Tcode_run(Tcode *self)
+{
+    static const void *const handlers[] = {
+        &&decode,
+        &&slow,
+        TC_MMOPS(L_MM)
+        TC_IMPLICIT(L_IMP)
+        ISA_BRANCH(L_BR)
+        TC_MODES(L_LCB, LDA)
+        &&L_INX_CPX_BNE,
+        &&L_INY_CPY_BNE,
+        &&L_DEX_BNE,
+        &&L_DEY_BNE,
+        &&L_LDA_ZPX_STA_ABY,
+        &&L_FILL_X,
+        &&L_FILL_Y,
+        &&L_COPY_X,
+        &&L_COPY_Y
+    };
+
+    Cpu *cpu = self->cpu;
+    Ram *ram = cpu->ram;
+    size_t size = Ram_size(ram);
+    Insn *insn = self->insn;
+    uint64_t *fused = self->fused;
+    Insn *ip;
+    LazyFlags flags;
+    uint16_t pc, sp, addr;
+    uint8_t a, x, y, v;
+    uint32_t from, to;
+    unsigned n;
+    int rc;
+
+    LOAD();
+    DISPATCH();
+
+decode:
+    decode(self, pc);
+    goto *handlers[ip->h];
+
+slow:
+    SAVE();
+    rc = Cpu_step(cpu, 0);
+    if (rc < 0) return rc;
+    LOAD();
+    DISPATCH();
+
+    TC_MMOPS(MM_HANDLERS)
+
+L_RTS:
+    if (sp < 2) goto slow;
+    addr = cpu->stack[sp-1] << 8 | cpu->stack[sp-2];
+    if (addr >= size) goto slow;
+    sp -= 2;
+    pc = addr;
+    DISPATCH();
+L_SRA: SR(flags, a); NZ(flags, a); NEXT(1);
+L_SLA: SL(flags, a); NZ(flags, a); NEXT(1);
+L_RRA: RR(flags, a); NZ(flags, a); NEXT(1);
+L_RLA: RL(flags, a); NZ(flags, a); NEXT(1);
+L_INA: ++a; NZ(flags, a); NEXT(1);
+L_DEA: --a; NZ(flags, a); NEXT(1);
+L_INX: ++x; NZ(flags, x); NEXT(1);
+L_DEX: --x; NZ(flags, x); NEXT(1);
+L_INY: ++y; NZ(flags, y); NEXT(1);
+L_DEY: --y; NZ(flags, y); NEXT(1);
+L_SEZ: SEZ(flags); NEXT(1);
+L_CLZ: CLZ(flags); NEXT(1);
+L_SEN: SEN(flags); NEXT(1);
+L_CLN: CLN(flags); NEXT(1);
+L_SEC: SEC(flags); NEXT(1);
+L_CLC: CLC(flags); NEXT(1);
+L_TAX: x = a; NZ(flags, x); NEXT(1);
+L_TXA: a = x; NZ(flags, a); NEXT(1);
+L_TAY: y = a; NZ(flags, y); NEXT(1);
+L_TYA: a = y; NZ(flags, a); NEXT(1);
+L_TXY: y = x; NZ(flags, y); NEXT(1);
+L_TYX: x = y; NZ(flags, x); NEXT(1);
+L_PHA: PUSH(a);
+L_PLA: PULL(a);
+L_PHX: PUSH(x);
+L_PLX: PULL(x);
+L_PHY: PUSH(y);
+L_PLY: PULL(y);
+
+    BSR_HANDLER(REL, 2)
+    BSR_HANDLER(ABS, 3)
+    BR_HANDLERS(BRA)
+    BR_HANDLERS(BNE)
+    BR_HANDLERS(BEQ)
+    BR_HANDLERS(BPL)
+    BR_HANDLERS(BMI)
+    BR_HANDLERS(BCC)
+    BR_HANDLERS(BCS)
+
+    TC_MODES(LCB_HANDLER, LDA)
+    ICB_HANDLER(x, INX, CPX)
+    ICB_HANDLER(y, INY, CPY)
+    DB_HANDLER(x, DEX)
+    DB_HANDLER(y, DEY)
+    FILL_HANDLER(x, X, DEX)
+    FILL_HANDLER(y, Y, DEY)
+    COPY_HANDLER(x, X, DEX)
+    COPY_HANDLER(y, Y, DEY)
+
+L_LDA_ZPX_STA_ABY:
+    if (ip[2].h != H_STA_ABY) goto L_LDA_ZPX;
+    EA_ZPX;
+    ++fused[F_LDA_ZPX_STA_ABY];
+    OP_LDA;
+    pc += 2;
+    ip += 2;
+    EA_ABY;
+    OP_STA;
+    NEXT(3);
+}
+
+void Tcode_showStats(const Tcode *self, FILE *out)
+{
+    fputs("fused instructions executed:\n", out);
+    for (int i = 0; i < F_COUNT; ++i)
+    {
+        fprintf(out, "  %-36s %" PRIu64 "\n", fusedNames[i], self->fused[i]);
+    }
+}
+
+#else
+
+Tcode *Tcode_create(Cpu *cpu)
+{
+    return 0;
+}
+
+int Tcode_run(Tcode *self)
+{
+    return -1;
+}
+
+void Tcode_showStats(const Tcode *self, FILE *out)
+{
+}
+
+#endif
+
+void Tcode_destroy(Tcode *self)
+{
+    if (!self) return;
+    Ram_watchCode(self->cpu->ram, 0, 0);
+    free(self);
+}
@@ -0,0 +1,14 @@
+#ifndef TCODE_H
+#define TCODE_H
+
+#include <stdio.h>
+
+typedef struct Cpu Cpu;
+typedef struct Tcode Tcode;
+
+Tcode *Tcode_create(Cpu *cpu);
+int Tcode_run(Tcode *self);
+void Tcode_showStats(const Tcode *self, FILE *out);
+void Tcode_destroy(Tcode *self);
+
+#endif
@@ -0,0 +1,291 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+/* defined by the build where POSIX threads are available, otherwise
+ * records are written synchronously */
+#ifdef TRACER_THREAD
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#endif
+
+#include "tracer.h"
+#include "cpu.h"
+#include "opcode.h"
+
+/* The ring has a single producer (the CPU) and a single consumer (the
+ * writer thread). head and tail count records pushed and written, the
+ * producer only moves head and the consumer only moves tail. The writer
+ * flushes its output and sleeps for a millisecond whenever the ring is
+ * empty, a full ring makes the CPU yield until there's room.
+ */
+
+#define RECORDSIZE (37 + 32)
+#define BATCH 1024
+
+struct Tracer
+{
+    FILE *out;
+    TraceRecord *ring;
+    size_t mask;
+    int drop;
+    uint64_t dropped;
+#ifdef TRACER_THREAD
+    atomic_size_t head;
+    atomic_size_t tail;
+    atomic_int done;
+    pthread_t writer;
+    char buf[BATCH * RECORDSIZE];
+#endif
+};
+
+static void hex(char *to, unsigned v, int digits)
+{
+    static const char digit[] = "0123456789abcdef";
+    while (digits--)
+    {
+        to[digits] = digit[v & 0xf];
+        v >>= 4;
+    }
+}
+
+static void logByte(char *dis, int off, uint8_t byte)
+{
+    hex(dis+off, byte, 2);
+}
+
+static void logInst(char *dis, const char *inst)
+{
+    memcpy(dis+12, inst, strlen(inst));
+}
+
+static void logIndex(char *dis, const char *index)
+{
+    if (index) memcpy(dis, index, 2);
+}
+
+static void logAbs(char *dis, uint16_t addr, const char *index)
+{
+    dis[16] = '$';
+    hex(dis+17, addr, 4);
+    logIndex(dis+21, index);
+}
+
+static void logRel(char *dis, int8_t off)
+{
+    int v = off < 0 ? -off : off;
+    char *p = dis+16;
+    *p++ = off < 0 ? '-' : '+';
+    if (v >= 100) *p++ = '0' + v / 100;
+    if (v >= 10) *p++ = '0' + v / 10 % 10;
+    *p = '0' + v % 10;
+}
+
+/* a negative argument used to be printed sign extended, showing "ff" */
+static void logImm(char *dis, int8_t arg)
+{
+    memcpy(dis+16, "#$", 2);
+    hex(dis+18, arg < 0 ? 0xff : arg, 2);
+}
+
+static void logZp(char *dis, uint8_t addr, const char *index)
+{
+    dis[16] = '$';
+    hex(dis+17, addr, 2);
+    logIndex(dis+19, index);
+}
+
+static void logZpInd(char *dis, uint8_t addr)
+{
+    memcpy(dis+16, "($", 2);
+    hex(dis+18, addr, 2);
+    memcpy(dis+20, "),Y", 3);
+}
+
+static void logRes(char *dis, uint8_t res)
+{
+    memcpy(dis+26, "; $", 3);
+    hex(dis+29, res, 2);
+}
+
+static void logOperand(char *dis, const TraceRecord *rec)
+{
+    uint8_t op = rec->bytes[0];
+    uint16_t abs = rec->bytes[2] << 8 | rec->bytes[1];
+
+    if ((op & O_AM_JUMP) == O_AM_JUMP)
+    {
+        if (op & O_AM_ABSOLUTE) logAbs(dis, abs, 0);
+        else logRel(dis, (int8_t)rec->bytes[1]);
+        return;
+    }
+    /* RTX, RBK and WBK, the implicit instructions with an operand */
+    if ((op & O_AM_IMPLICIT) == O_AM_IMPLICIT)
+    {
+        logAbs(dis, rec->bytes[1] << 8, 0);
+        return;
+    }
+    switch (op & 7)
+    {
+        case O_AM_IMMEDIATE:
+            logImm(dis, rec->bytes[1]);
+            break;
+        case O_AM_ABSOLUTE:
+            logAbs(dis, abs, 0);
+            break;
+        case O_AM_ZP_ABS:
+            logZp(dis, rec->bytes[1], 0);
+            break;
+        case O_AM_IDX_X:
+            logAbs(dis, abs, ",X");
+            break;
+        case O_AM_ZP_IDX_X:
+            logZp(dis, rec->bytes[1], ",X");
+            break;
+        case O_AM_IDX_Y:
+            logAbs(dis, abs, ",Y");
+            break;
+        case O_AM_ZP_IDX_Y:
+            logZp(dis, rec->bytes[1], ",Y");
+            break;
+        case O_AM_ZP_IND_Y:
+            logZpInd(dis, rec->bytes[1]);
+            break;
+    }
+}
+
+void Tracer_disassemble(const TraceRecord *rec, char *dis)
+{
+    strcpy(dis, "                               ");
+    for (int i = 0; i < rec->nbytes; ++i) logByte(dis, 3 * i, rec->bytes[i]);
+    logInst(dis, Opcode_name(rec->bytes[0]));
+    if (rec->operand) logOperand(dis, rec);
+    if (rec->hasres) logRes(dis, rec->res);
+}
+
+/* the state line and the disassembly line, RECORDSIZE bytes */
+static void formatRecord(char *to, const TraceRecord *rec)
+{
+    memcpy(to, "PC:xxxx - A:xx X:xx Y:xx - [ _ _ _ ]\n", 37);
+    hex(to+3, rec->pc, 4);
+    hex(to+12, rec->regs[CR_A], 2);
+    hex(to+17, rec->regs[CR_X], 2);
+    hex(to+22, rec->regs[CR_Y], 2);
+    if (rec->flags & CF_ZERO) to[29] = 'Z';
+    if (rec->flags & CF_NEGATIVE) to[31] = 'N';
+    if (rec->flags & CF_CARRY) to[33] = 'C';
+    Tracer_disassemble(rec, to+37);
+    to[RECORDSIZE-1] = '\n';
+}
+
+static void writeRecord(FILE *out, const TraceRecord *rec)
+{
+    char buf[RECORDSIZE];
+    formatRecord(buf, rec);
+    fwrite(buf, 1, RECORDSIZE, out);
+}
+
+#ifdef TRACER_THREAD
+static void *writer(void *arg)
+{
+    Tracer *self = arg;
+    const struct timespec idle = { 0, 1000000 };
+    char *buf = self->buf;
+    size_t tail = 0;
+    for (;;)
+    {
+        int done = atomic_load_explicit(&self->done, memory_order_acquire);
+        size_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+        if (head == tail)
+        {
+            fflush(self->out);
+            if (done) break;
+            nanosleep(&idle, 0);
+            continue;
+        }
+        size_t n = 0;
+        while (tail != head && n < BATCH)
+        {
+            formatRecord(buf + n++ * RECORDSIZE,
+                    self->ring + (tail++ & self->mask));
+        }
+        atomic_store_explicit(&self->tail, tail, memory_order_release);
+        fwrite(buf, 1, n * RECORDSIZE, self->out);
+    }
+    return 0;
+}
+#endif
+
+Tracer *Tracer_create(FILE *out, size_t size, int drop)
+{
+    Tracer *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    self->out = out;
+    self->drop = drop;
+#ifdef TRACER_THREAD
+    size_t n = 1;
+    while (n < size) n <<= 1;
+    self->mask = n - 1;
+    atomic_init(&self->head, 0);
+    atomic_init(&self->tail, 0);
+    atomic_init(&self->done, 0);
+    self->ring = malloc(n * sizeof *self->ring);
+    if (self->ring && pthread_create(&self->writer, 0, writer, self))
+    {
+        free(self->ring);
+        self->ring = 0;
+    }
+#else
+    (void)size;
+#endif
+    return self;
+}
+
+void Tracer_push(Tracer *self, const TraceRecord *rec)
+{
+#ifdef TRACER_THREAD
+    if (self->ring)
+    {
+        size_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+        while (head - atomic_load_explicit(&self->tail, memory_order_acquire)
+                > self->mask)
+        {
+            if (self->drop)
+            {
+                ++self->dropped;
+                return;
+            }
+            sched_yield();
+        }
+        self->ring[head & self->mask] = *rec;
+        atomic_store_explicit(&self->head, head + 1, memory_order_release);
+        return;
+    }
+#endif
+    writeRecord(self->out, rec);
+}
+
+uint64_t Tracer_dropped(const Tracer *self)
+{
+    return self->dropped;
+}
+
+void Tracer_destroy(Tracer *self)
+{
+    if (!self) return;
+#ifdef TRACER_THREAD
+    if (self->ring)
+    {
+        atomic_store_explicit(&self->done, 1, memory_order_release);
+        pthread_join(self->writer, 0);
+        free(self->ring);
+    }
+#endif
+    fflush(self->out);
+    free(self);
+}
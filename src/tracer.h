@@ -0,0 +1,37 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* One traced instruction: the CPU state before executing it, the bytes
+ * fetched for it, whether its operand was decoded, and the result shown
+ * for some instructions. The text is only formatted when writing it. */
+typedef struct TraceRecord
+{
+    uint16_t pc;
+    uint8_t regs[3];
+    uint8_t flags;
+    uint8_t bytes[3];
+    uint8_t nbytes;
+    uint8_t operand;
+    uint8_t hasres;
+    uint8_t res;
+} TraceRecord;
+
+typedef struct Tracer Tracer;
+
+/* Records are written to out by a separate thread, through a ring of size
+ * records. When the ring is full, the CPU waits for the writer, or the
+ * record is dropped and counted if drop is set. Without thread support,
+ * records are written directly. */
+Tracer *Tracer_create(FILE *out, size_t size, int drop);
+void Tracer_push(Tracer *self, const TraceRecord *rec);
+uint64_t Tracer_dropped(const Tracer *self);
+/* the disassembly line of a record, dis must hold 32 bytes */
+void Tracer_disassemble(const TraceRecord *rec, char *dis);
+/* writes all pending records and stops the writer */
+void Tracer_destroy(Tracer *self);
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "verifier.h"
+#include "ram.h"
+#include "opcode.h"
+
+/* Finds all instructions reachable from the start address (following
+ * branches and the return addresses of BSR) and checks which of them can
+ * never fail a range check, no matter what the registers contain. Only
+ * static operands are considered, so indexed and indirect accesses are
+ * only safe if they can't leave the Ram. A full 64KB image doesn't need
+ * any of this, no check can ever fail there.
+ *
+ * The pages holding these instructions are marked in the Ram, and every
+ * instruction overwritten later is checked again.
+ */
+
+struct Verifier
+{
+    Ram *ram;
+    size_t size;
+    size_t ntodo;
+    uint8_t reached[RAM_MAXSIZE];
+    uint8_t safe[RAM_MAXSIZE];
+    uint16_t todo[RAM_MAXSIZE];
+};
+
+/* returns the length of the instruction at pc if it can't leave the Ram,
+ * 0 otherwise, and its static branch target in *target */
+static unsigned check(const Verifier *self, uint16_t pc, int32_t *target)
+{
+    const Ram *ram = self->ram;
+    size_t size = self->size;
+    uint8_t op = Ram_get(ram, pc);
+    const OpcodeInfo *oi = Opcode_info(op);
+    unsigned len = oi->size;
+
+    *target = -1;
+    if (oi->cls == OC_ILLEGAL || op == O_HLT) return 0;
+    if (pc + len >= size) return 0;
+    uint32_t arg = Ram_get(ram, pc + 1);
+    if (len == 3) arg |= Ram_get(ram, pc + 2) << 8;
+
+    if (oi->cls == OC_MULTIMODE)
+    {
+        switch (oi->mode)
+        {
+            case O_AM_ABSOLUTE:
+            case O_AM_ZP_ABS:
+                if (arg >= size) return 0;
+                break;
+            case O_AM_IDX_X:
+            case O_AM_IDX_Y:
+            case O_AM_ZP_IDX_X:
+            case O_AM_ZP_IDX_Y:
+                if (size < RAM_MAXSIZE && arg + 0xff >= size) return 0;
+                break;
+            case O_AM_ZP_IND_Y:
+                if (size < RAM_MAXSIZE) return 0;
+                break;
+        }
+    }
+    else if (oi->cls == OC_BRANCH)
+    {
+        *target = oi->mode == O_AM_ABSOLUTE ? (int32_t)arg
+            : pc + 2 + (int8_t)arg;
+        if (*target < 0 || (size_t)*target >= size)
+        {
+            *target = -1;
+            return 0;
+        }
+    }
+    else if (op == O_RTS && size < RAM_MAXSIZE) return 0;
+    return len;
+}
+
+static void reach(Verifier *self, int32_t pc)
+{
+    if (pc < 0 || (size_t)pc >= self->size || self->reached[pc]) return;
+    self->reached[pc] = 1;
+    self->todo[self->ntodo++] = pc;
+}
+
+/* watches all bytes of the instruction at pc, at least its opcode, so any
+ * change to it is checked again */
+static void mark(Verifier *self, uint16_t pc)
+{
+    size_t len = Opcode_info(Ram_get(self->ram, pc))->size;
+    if (!len) len = 1;
+    if (pc + len > self->size) len = self->size - pc;
+    Ram_markCode(self->ram, pc, len);
+}
+
+static void walk(Verifier *self)
+{
+    while (self->ntodo)
+    {
+        uint16_t pc = self->todo[--self->ntodo];
+        uint8_t op = Ram_get(self->ram, pc);
+        const OpcodeInfo *oi = Opcode_info(op);
+        int32_t target;
+
+        self->safe[pc] = !!check(self, pc, &target);
+        mark(self, pc);
+        if (oi->cls == OC_ILLEGAL || op == O_HLT || op == O_RTS) continue;
+        if (pc + oi->size >= self->size) continue;
+        reach(self, target);
+        if ((op & 0xfe) != O_BRA) reach(self, pc + oi->size);
+    }
+}
+
+static void written(void *ctx, uint16_t at, size_t size)
+{
+    Verifier *self = ctx;
+    uint16_t pc = at - 2;
+    int32_t target;
+
+    for (size_t i = 0; i < size + 2; ++i, ++pc)
+    {
+        if (!self->reached[pc]) continue;
+        self->safe[pc] = !!check(self, pc, &target);
+        mark(self, pc);
+    }
+}
+
+Verifier *Verifier_create(Ram *ram, uint16_t start)
+{
+    Verifier *self = calloc(1, sizeof *self);
+    if (!self) return 0;
+    self->ram = ram;
+    self->size = Ram_size(ram);
+    reach(self, start);
+    walk(self);
+    Ram_watchCode(ram, written, self);
+    return self;
+}
+
+const uint8_t *Verifier_safe(const Verifier *self)
+{
+    return self->safe;
+}
+
+void Verifier_destroy(Verifier *self)
+{
+    if (!self) return;
+    Ram_watchCode(self->ram, 0, 0);
+    free(self);
+}
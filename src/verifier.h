@@ -0,0 +1,13 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <stdint.h>
+
+typedef struct Ram Ram;
+typedef struct Verifier Verifier;
+
+Verifier *Verifier_create(Ram *ram, uint16_t start);
+const uint8_t *Verifier_safe(const Verifier *self);
+void Verifier_destroy(Verifier *self);
+
+#endif
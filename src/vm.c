@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #ifdef BUILTIN_GETOPT
 #include "builtin_getopt.h"
@@ -14,6 +15,17 @@
 #include "ram.h"
 #include "cpu.h"
 #include "converter.h"
+#include "hexreader.h"
+#include "tcode.h"
+#include "jit.h"
+#include "snapshot.h"
+#include "image.h"
+#include "mmio.h"
+#include "input.h"
+#include "output.h"
+#include "tracer.h"
+#include "opcode.h"
+#include "vm.h"
 
 typedef enum mode
 {
@@ -25,15 +37,16 @@ typedef enum dump
 {
     D_NONE,
     D_BIN,
-    D_HEX
+    D_HEX,
+    D_CHANGES
 } dump;
 
 static void dumpRamHex(const Ram *ram)
 {
     int x = 0;
-    for (size_t i = 0; i < Ram_size(ram); ++i)
+    for (size_t i = 0; i < Ram_physSize(ram); ++i)
     {
-        printf("%02x ", Ram_get(ram, i));
+        printf("%02x ", Ram_physGet(ram, i));
         if (++x == 26)
         {
             x = 0;
@@ -44,57 +57,133 @@ static void dumpRamHex(const Ram *ram)
     fflush(stdout);
 }
 
+/* one line per changed run of bytes, starting with its address */
+static void dumpRamChanges(const Ram *ram, const Ram *loaded)
+{
+    size_t size = Ram_physSize(ram);
+    size_t len;
+    for (size_t at = Ram_nextChange(ram, loaded, 0, &len); at < size;
+            at = Ram_nextChange(ram, loaded, at + len, &len))
+    {
+        printf("%04zx:", at);
+        for (size_t i = 0; i < len; ++i)
+        {
+            printf(" %02x", Ram_physGet(ram, at + i));
+        }
+        puts("");
+    }
+    fflush(stdout);
+}
+
 static void dumpRam(const Ram *ram)
 {
-    for (size_t i = 0; i < Ram_size(ram); ++i)
+    for (size_t i = 0; i < Ram_physSize(ram); ++i)
     {
-        putchar(Ram_get(ram, i));
+        putchar(Ram_physGet(ram, i));
     }
     fflush(stdout);
 }
 
-static Ram *createXcode(FILE *prg, int hex, uint16_t load)
+/* steps up to the first instruction reading input, returns -1 if the program
+ * stops before */
+static int runToInput(Cpu *cpu, const Ram *ram)
+{
+    for (;;)
+    {
+        switch (Ram_get(ram, Cpu_pc(cpu)))
+        {
+            case O_RUD:
+            case O_RSD:
+            case O_RCH:
+            case O_RTX:
+            case O_RBK:
+                return 0;
+        }
+        if (Cpu_step(cpu, 0) < 0) return -1;
+    }
+}
+
+/* runs up to the first instruction reading input and saves a snapshot
+ * there, together with the output collected in pending, which is a tee of
+ * the CPU's output */
+static int saveSnapshot(Cpu *cpu, const Ram *ram, const char *savefile,
+        const Output *pending)
+{
+    int rc = runToInput(cpu, ram);
+    Output_tee(Cpu_output(cpu), 0);
+    if (rc < 0)
+    {
+        fputs("Program stopped before reading input, no snapshot "
+                "saved.\n", stderr);
+        return 0;
+    }
+
+    FILE *out = fopen(savefile, "wb");
+    if (!out)
+    {
+        fprintf(stderr, "Error opening %s for writing.\n", savefile);
+        return -1;
+    }
+    size_t outsize;
+    const uint8_t *output = Output_data(pending, &outsize);
+    rc = Snapshot_save(cpu, output, outsize, out);
+    if (fclose(out) != 0 || rc < 0)
+    {
+        fprintf(stderr, "Error writing snapshot %s.\n", savefile);
+        return -1;
+    }
+    return 0;
+}
+
+static void hexError(const HexReader *reader)
+{
+    fprintf(stderr, "parse error at line %u, column %u\n",
+            HexReader_line(reader), HexReader_column(reader));
+}
+
+Ram *createXcode(FILE *prg, int hex, uint16_t load)
 {
     Ram *ram = Ram_create(0x10000, 0);
     if (!ram) return 0;
 
-    uint8_t *buf = malloc(0x10000 - load);
+    size_t max = 0x10000 - load;
+    uint8_t *buf = malloc(max);
     if (!buf)
     {
         Ram_destroy(ram);
         return 0;
     }
 
-    uint16_t sz = 0;
+    size_t sz = 0;
 
     if (hex)
     {
-        unsigned val;
-        int rc;
-
-        while ((rc = fscanf(prg, "%x", &val)) > 0)
+        HexReader *reader = HexReader_create(prg);
+        long n = reader ? HexReader_read(reader, buf, max) : -1;
+        uint8_t extra;
+        long more = n == (long)max ? HexReader_read(reader, &extra, 1) : 0;
+        if (n < 0 || more < 0)
         {
-            if (val > 0xff)
-            {
-                fputs("parse error!\n", stderr);
-                Ram_destroy(ram);
-                free(buf);
-                return 0;
-            }
-            buf[sz++] = val;
+            if (reader) hexError(reader);
+            HexReader_destroy(reader);
+            Ram_destroy(ram);
+            free(buf);
+            return 0;
         }
-        if (!rc)
+        HexReader_destroy(reader);
+        if (more)
         {
-            fputs("parse error!\n", stderr);
+            fputs("loading error (input too large?)\n", stderr);
             Ram_destroy(ram);
             free(buf);
             return 0;
         }
+        sz = n;
     }
     else
     {
         size_t szr;
-        while ((szr = fread(buf + sz, 1, 0x10000 - load - sz, prg)))
+        while ((szr = fread(buf + sz, 1, max - sz, prg)))
         {
             sz += szr;
         }
@@ -119,44 +208,63 @@ static Ram *createXcode(FILE *prg, int hex, uint16_t load)
     return ram;
 }
 
-static Ram *createXram(FILE *prg, int hex)
+/* with banks, the Ram already has its full size and data goes to the
+ * physical image */
+static int append(Ram *ram, size_t *at, const uint8_t *data, size_t size)
+{
+    if (!Ram_banks(ram)) return Ram_append(ram, data, size);
+    if (Ram_physLoad(ram, *at, data, size) < 0) return -1;
+    *at += size;
+    return 0;
+}
+
+Ram *createXram(FILE *prg, int hex, unsigned nbanks)
 {
-    Ram *ram = Ram_create(0,0);
+    Ram *ram = Ram_create(nbanks ? RAM_MAXSIZE : 0, 0);
     if (!ram) return 0;
+    if (nbanks && Ram_addBanks(ram, nbanks) < 0)
+    {
+        fputs("invalid number of banks\n", stderr);
+        Ram_destroy(ram);
+        return 0;
+    }
+    size_t at = 0;
+    uint8_t buf[RAM_PAGESIZE];
 
     if (hex)
     {
-        unsigned val;
-        int rc;
-        while ((rc = fscanf(prg, "%x", &val)) > 0)
+        HexReader *reader = HexReader_create(prg);
+        if (!reader)
         {
-            if (val > 0xff)
-            {
-                fputs("parse error!\n", stderr);
-                Ram_destroy(ram);
-                return 0;
-            }
-            if (Ram_appendByte(ram, val) < 0)
+            Ram_destroy(ram);
+            return 0;
+        }
+        long sz;
+        while ((sz = HexReader_read(reader, buf, sizeof buf)) > 0)
+        {
+            if (append(ram, &at, buf, sz) < 0)
             {
                 fputs("loading error (input too large?)\n", stderr);
+                HexReader_destroy(reader);
                 Ram_destroy(ram);
                 return 0;
             }
         }
-        if (!rc)
+        if (sz < 0)
         {
-            fputs("parse error!\n", stderr);
+            hexError(reader);
+            HexReader_destroy(reader);
             Ram_destroy(ram);
             return 0;
         }
+        HexReader_destroy(reader);
     }
     else
     {
-        uint8_t buf[0x1000];
         size_t sz;
-        while ((sz = fread(buf, 1, 0x1000, prg)))
+        while ((sz = fread(buf, 1, sizeof buf, prg)))
         {
-            if (Ram_append(ram, buf, sz) < 0)
+            if (append(ram, &at, buf, sz) < 0)
             {
                 fputs("loading error (input too large?)\n", stderr);
                 Ram_destroy(ram);
@@ -174,6 +282,59 @@ static Ram *createXram(FILE *prg, int hex)
     return ram;
 }
 
+Ram *mapXcode(const Image *image, uint16_t load)
+{
+    if (Image_size(image) > 0x10000u - load)
+    {
+        fputs("loading error (input too large?)\n", stderr);
+        return 0;
+    }
+    Ram *ram = Ram_create(0x10000, 0);
+    if (!ram) return 0;
+    if (Ram_map(ram, load, Image_data(image), Image_size(image)) < 0)
+    {
+        fputs("unknown loading error\n", stderr);
+        Ram_destroy(ram);
+        return 0;
+    }
+    return ram;
+}
+
+/* with banks, only the part beyond the address space is copied */
+Ram *mapXram(const Image *image, unsigned nbanks)
+{
+    size_t size = Image_size(image);
+    size_t mapped = size > RAM_MAXSIZE ? RAM_MAXSIZE : size;
+
+    if (size > RAM_MAXSIZE && !nbanks)
+    {
+        fputs("loading error (input too large?)\n", stderr);
+        return 0;
+    }
+    Ram *ram = Ram_create(nbanks ? RAM_MAXSIZE : size, 0);
+    if (!ram) return 0;
+    if (Ram_map(ram, 0, Image_data(image), mapped) < 0)
+    {
+        fputs("unknown loading error\n", stderr);
+        Ram_destroy(ram);
+        return 0;
+    }
+    if (nbanks && Ram_addBanks(ram, nbanks) < 0)
+    {
+        fputs("invalid number of banks\n", stderr);
+        Ram_destroy(ram);
+        return 0;
+    }
+    if (size > mapped && Ram_physLoad(ram, mapped, Image_data(image) + mapped,
+                size - mapped) < 0)
+    {
+        fputs("loading error (input too large?)\n", stderr);
+        Ram_destroy(ram);
+        return 0;
+    }
+    return ram;
+}
+
 int vmmain(int argc, char **argv)
 {
     mode m = M_XCODE;
@@ -181,17 +342,37 @@ int vmmain(int argc, char **argv)
     uint16_t start = 0x100;
     int userstart = 0;
     int trace = 0;
+    int interp = 0;
+    int native = 0;
+    int stats = 0;
     int hex = 0;
     FILE *convtable = 0;
+    const char *savefile = 0;
+    int resume = 0;
+    int devices = 0;
+    uint16_t devbase = 0;
+    unsigned nbanks = 0;
+    int interactive = 0;
+    unsigned interval = 0;
+    const char *infile = 0;
+    const char *outfile = 0;
     int opt;
 
     Ram *ram = 0;
+    Ram *loaded = 0;
+    Snapshot *snapshot = 0;
+    Image *image = 0;
+    Image *inimage = 0;
+    FILE *out = 0;
+    Mmio *mmio = 0;
     Converter *converter = 0;
     Cpu *cpu = 0;
+    Tcode *tcode = 0;
+    Jit *jit = 0;
+    Tracer *tracer = 0;
+    Output *pending = 0;
 
-    setvbuf(stdin, 0, _IONBF, 0);
-
-    while ((opt = getopt(argc, argv, "rs:htc:dx")) != -1)
+    while ((opt = getopt(argc, argv, "rs:htTijfc:dxwS:lm:b:uF:I:O:")) != -1)
     {
         switch (opt)
         {
@@ -206,6 +387,18 @@ int vmmain(int argc, char **argv)
             case 't':
                 trace = 1;
                 break;
+            case 'T':
+                trace = 2;
+                break;
+            case 'i':
+                interp = 1;
+                break;
+            case 'j':
+                native = 1;
+                break;
+            case 'f':
+                stats = 1;
+                break;
             case 'h':
                 hex = 1;
                 break;
@@ -224,65 +417,214 @@ int vmmain(int argc, char **argv)
             case 'x':
                 d = D_HEX;
                 break;
+            case 'w':
+                d = D_CHANGES;
+                break;
+            case 'S':
+                savefile = optarg;
+                break;
+            case 'l':
+                resume = 1;
+                break;
+            case 'm':
+                devices = 1;
+                devbase = atoi(optarg);
+                break;
+            case 'b':
+                nbanks = atoi(optarg);
+                if (!nbanks) goto usage;
+                break;
+            case 'u':
+                interactive = 1;
+                break;
+            case 'F':
+                interval = atoi(optarg);
+                break;
+            case 'I':
+                infile = optarg;
+                break;
+            case 'O':
+                outfile = optarg;
+                break;
             default:
                 goto usage;
         }
     }
     if (optind == argc || optind < argc-1) goto usage;
+    if (savefile && (convtable || nbanks)) goto usage;
 
-    FILE *prg = fopen(argv[optind], hex?"r":"rb");
-    if (!prg)
+    if (resume)
     {
-        fprintf(stderr, "Error opening %s for reading.\n", argv[optind]);
-        goto error;
+        snapshot = Snapshot_open(argv[optind]);
+        if (!snapshot)
+        {
+            fprintf(stderr, "Error reading snapshot %s.\n", argv[optind]);
+            goto error;
+        }
+        ram = Snapshot_ram(snapshot);
+        start = 0;
     }
-
-    if (m == M_XRAM)
+    else if (!hex)
     {
-        ram = createXram(prg, hex);
+        image = Image_open(argv[optind],
+                RAM_MAXSIZE + (RAM_MAXBANKS - 1) * RAM_BANKSIZE);
+        if (!image)
+        {
+            fprintf(stderr, "Error opening %s for reading.\n", argv[optind]);
+            goto error;
+        }
+        ram = m == M_XRAM ? mapXram(image, nbanks) : mapXcode(image, start);
     }
     else
     {
-        ram = createXcode(prg, hex, start);
+        FILE *prg = fopen(argv[optind], hex?"r":"rb");
+        if (!prg)
+        {
+            fprintf(stderr, "Error opening %s for reading.\n", argv[optind]);
+            goto error;
+        }
+
+        if (m == M_XRAM)
+        {
+            ram = createXram(prg, hex, nbanks);
+        }
+        else
+        {
+            ram = createXcode(prg, hex, start);
+        }
+        fclose(prg);
     }
-    fclose(prg);
     if (!ram) goto error;
-
+    if (nbanks && !Ram_banks(ram) && Ram_addBanks(ram, nbanks) < 0)
+    {
+        fputs("Banks need a 64KB RAM and 2 to 256 banks.\n", stderr);
+        goto error;
+    }
+    if (d == D_CHANGES && !(loaded = Ram_clone(ram))) goto error;
     if (convtable)
     {
         converter = Converter_create(ram);
         if (!converter) goto error;
-        if (Converter_readTable(converter, convtable) < 0)
+        HexReader *reader = HexReader_create(convtable);
+        if (!reader) goto error;
+        if (Converter_readTable(converter, reader) < 0)
         {
-            fputs("Error reading conversion table.\n", stderr);
+            fprintf(stderr, "Error reading conversion table at line %u, "
+                    "column %u.\n", HexReader_line(reader),
+                    HexReader_column(reader));
+            HexReader_destroy(reader);
             goto error;
         }
+        HexReader_destroy(reader);
         fclose(convtable);
         convtable = 0;
     }
 
     cpu = Cpu_create(ram, start, converter);
     if (!cpu) goto error;
+    Cpu_setOutput(cpu, interactive, interval);
+    if (infile)
+    {
+        inimage = Image_open(infile, (size_t)-1 / 2);
+        if (!inimage)
+        {
+            fprintf(stderr, "Error opening %s for reading.\n", infile);
+            goto error;
+        }
+        Input *input = Input_createMemory(Image_data(inimage),
+                Image_size(inimage));
+        if (!input) goto error;
+        Cpu_setIo(cpu, input, 0);
+    }
+    else if (!interactive)
+    {
+        Input *input = Input_create(0, 1 << 16);
+        if (!input) goto error;
+        Cpu_setIo(cpu, input, 0);
+    }
+    if (outfile)
+    {
+        out = fopen(outfile, "wb");
+        if (!out)
+        {
+            fprintf(stderr, "Error opening %s for writing.\n", outfile);
+            goto error;
+        }
+        Output *output = Output_createFile(out);
+        if (!output) goto error;
+        Cpu_setIo(cpu, 0, output);
+    }
+    else if (!interactive)
+    {
+        fflush(stdout);
+        Output *output = Output_createFd(1, 1 << 16);
+        if (!output) goto error;
+        Cpu_setIo(cpu, 0, output);
+    }
+    if (devices && !(mmio = Mmio_create(ram, devbase, Cpu_output(cpu),
+                    interactive)))
+    {
+        fputs("Devices don't fit in RAM.\n", stderr);
+        goto error;
+    }
+    if (snapshot && Snapshot_restore(snapshot, cpu) < 0)
+    {
+        fprintf(stderr, "Invalid snapshot %s.\n", argv[optind]);
+        goto error;
+    }
+
+    if (savefile)
+    {
+        if (!(pending = Output_createMemory())) goto error;
+        Output_tee(Cpu_output(cpu), pending);
+    }
+    if (snapshot)
+    {
+        size_t outsize;
+        const uint8_t *output = Snapshot_output(snapshot, &outsize);
+        Output_write(Cpu_output(cpu), output, outsize);
+        if (interactive) Output_flush(Cpu_output(cpu));
+    }
+    if (savefile && saveSnapshot(cpu, ram, savefile, pending) < 0)
+    {
+        goto error;
+    }
 
-    int rc = 0;
-    while (rc >= 0)
+    if (trace)
+    {
+        tracer = Tracer_create(stderr, 1 << 16, trace == 2);
+        if (!tracer) goto error;
+        Cpu_setTrace(cpu, tracer);
+    }
+    else if (!interp && !converter)
+    {
+        if (native) jit = Jit_create(cpu);
+        if (!jit) tcode = Tcode_create(cpu);
+    }
+
+    if (jit) Jit_run(jit);
+    else if (tcode) Tcode_run(tcode);
+    else Cpu_run(cpu, 0);
+    Output_flush(Cpu_output(cpu));
+    if (tracer)
     {
-        if (trace)
+        uint64_t dropped = Tracer_dropped(tracer);
+        Tracer_destroy(tracer);
+        tracer = 0;
+        if (dropped)
         {
-            CpuFlags f = Cpu_flags(cpu);
-            fprintf(stderr, "PC:%04x - A:%02x X:%02x Y:%02x - [ %c %c %c ]\n",
-                    Cpu_pc(cpu), Cpu_reg(cpu, CR_A),
-                    Cpu_reg(cpu, CR_X), Cpu_reg(cpu, CR_Y),
-                    f & CF_ZERO ? 'Z' : '_',
-                    f & CF_NEGATIVE ? 'N' : '_',
-                    f & CF_CARRY ? 'C' : '_');
-            char dis[32];
-            rc = Cpu_step(cpu, dis);
-            fprintf(stderr, "%s\n", dis);
-            fflush(stderr);
+            fprintf(stderr, "=== %" PRIu64 " trace records dropped ===\n",
+                    dropped);
         }
-        else rc = Cpu_step(cpu, 0);
     }
+
+    if (stats)
+    {
+        if (tcode) Tcode_showStats(tcode, stderr);
+        fprintf(stderr, "writes to code pages: %" PRIu64 "\n",
+                Ram_codeWrites(ram));
+    }
+
     if (trace)
     {
         fputs("=== terminated ===\n", stderr);
@@ -292,6 +634,7 @@ int vmmain(int argc, char **argv)
     if (d)
     {
         if (d == D_HEX) dumpRamHex(ram);
+        else if (d == D_CHANGES) dumpRamChanges(ram, loaded);
         else dumpRam(ram);
     }
 
@@ -305,15 +648,35 @@ int vmmain(int argc, char **argv)
 
     if (convtable) fclose(convtable);
     Converter_destroy(converter);
+    Jit_destroy(jit);
+    Tcode_destroy(tcode);
+    Mmio_destroy(mmio);
+    Tracer_destroy(tracer);
     Cpu_destroy(cpu);
+    Output_destroy(pending);
+    if (out) fclose(out);
+    Image_close(inimage);
+    Ram_destroy(loaded);
     Ram_destroy(ram);
+    Image_close(image);
+    Snapshot_close(snapshot);
     return EXIT_SUCCESS;
 
 error:
     if (convtable) fclose(convtable);
     Converter_destroy(converter);
+    Jit_destroy(jit);
+    Tcode_destroy(tcode);
+    Mmio_destroy(mmio);
+    Tracer_destroy(tracer);
     Cpu_destroy(cpu);
+    Output_destroy(pending);
+    if (out) fclose(out);
+    Image_close(inimage);
+    Ram_destroy(loaded);
     Ram_destroy(ram);
+    Image_close(image);
+    Snapshot_close(snapshot);
     return EXIT_FAILURE;
 
 usage:
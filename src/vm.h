@@ -1,6 +1,18 @@
 #ifndef VM_H
 #define VM_H
 
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct Ram Ram;
+typedef struct Image Image;
+
+Ram *createXcode(FILE *prg, int hex, uint16_t load);
+Ram *createXram(FILE *prg, int hex, unsigned nbanks);
+/* the Ram uses the image until written, so it must be destroyed before
+ * closing the image */
+Ram *mapXcode(const Image *image, uint16_t load);
+Ram *mapXram(const Image *image, unsigned nbanks);
 int vmmain(int argc, char **argv);
 
 #endif